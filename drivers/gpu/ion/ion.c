@@ -29,12 +29,13 @@
 #include <linux/seq_file.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
+#include <linux/idr.h>
+#include <linux/rcupdate.h>
 
 #include "ion_priv.h"
 #include "../pvr/ion.h"
 #define DEBUG
 
-/* this function should only be called while dev->lock is held */
 static void ion_buffer_add(struct ion_device *dev,
 			   struct ion_buffer *buffer)
 {
@@ -42,6 +43,7 @@ static void ion_buffer_add(struct ion_device *dev,
 	struct rb_node *parent = NULL;
 	struct ion_buffer *entry;
 
+	spin_lock(&dev->buffer_lock);
 	while (*p) {
 		parent = *p;
 		entry = rb_entry(parent, struct ion_buffer, node);
@@ -58,9 +60,10 @@ static void ion_buffer_add(struct ion_device *dev,
 
 	rb_link_node(&buffer->node, parent, p);
 	rb_insert_color(&buffer->node, &dev->buffers);
+	spin_unlock(&dev->buffer_lock);
 }
 
-/* this function should only be called while dev->lock is held */
+/* this function should only be called while dev->heap_lock is held */
 static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 				     struct ion_device *dev,
 				     unsigned long len,
@@ -78,6 +81,12 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	kref_init(&buffer->ref);
 
 	ret = heap->ops->allocate(heap, buffer, len, align, flags);
+	if (ret && (heap->flags & ION_HEAP_FLAG_DEFER_FREE) &&
+	    ion_heap_freelist_size(heap)) {
+		/* memory may be stuck behind the free thread, reclaim it */
+		ion_heap_freelist_drain(heap, 0);
+		ret = heap->ops->allocate(heap, buffer, len, align, flags);
+	}
 	if (ret) {
 		kfree(buffer);
 		return ERR_PTR(ret);
@@ -90,16 +99,26 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	return buffer;
 }
 
+void ion_buffer_release(struct ion_buffer *buffer)
+{
+	buffer->heap->ops->free(buffer);
+	kfree(buffer);
+}
+
 static void ion_buffer_destroy(struct kref *kref)
 {
 	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
 	struct ion_device *dev = buffer->dev;
+	struct ion_heap *heap = buffer->heap;
 
-	buffer->heap->ops->free(buffer);
-	mutex_lock(&dev->lock);
+	spin_lock(&dev->buffer_lock);
 	rb_erase(&buffer->node, &dev->buffers);
-	mutex_unlock(&dev->lock);
-	kfree(buffer);
+	spin_unlock(&dev->buffer_lock);
+
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		ion_heap_freelist_add(heap, buffer);
+	else
+		ion_buffer_release(buffer);
 }
 
 static void ion_buffer_get(struct ion_buffer *buffer)
@@ -132,15 +151,19 @@ static struct ion_handle *ion_handle_create(struct ion_client *client,
 static void ion_handle_destroy(struct kref *kref)
 {
 	struct ion_handle *handle = container_of(kref, struct ion_handle, ref);
+	struct ion_client *client = handle->client;
 	/* XXX Can a handle be destroyed while it's map count is non-zero?:
 	   if (handle->map_cnt) unmap
 	 */
-	ion_buffer_put(handle->buffer);
-	mutex_lock(&handle->client->lock);
+	mutex_lock(&client->lock);
+	if (handle->id)
+		idr_remove(&client->idr, handle->id);
 	if (!RB_EMPTY_NODE(&handle->node))
-		rb_erase(&handle->node, &handle->client->handles);
-	mutex_unlock(&handle->client->lock);
-	kfree(handle);
+		rb_erase(&handle->node, &client->handles);
+	mutex_unlock(&client->lock);
+	ion_buffer_put(handle->buffer);
+	/* ion_handle_get_checked() may still be looking at it */
+	kfree_rcu(handle, rcu);
 }
 
 struct ion_buffer *ion_handle_buffer(struct ion_handle *handle)
@@ -148,95 +171,123 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle)
 	return handle->buffer;
 }
 
-static void ion_handle_get(struct ion_handle *handle)
-{
-	kref_get(&handle->ref);
-}
-
 static int ion_handle_put(struct ion_handle *handle)
 {
 	return kref_put(&handle->ref, ion_handle_destroy);
 }
 
+/* this function should only be called while client->lock is held */
 static struct ion_handle *ion_handle_lookup(struct ion_client *client,
 					    struct ion_buffer *buffer)
 {
-	struct rb_node *n;
+	struct rb_node *n = client->handles.rb_node;
 
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
+	while (n) {
 		struct ion_handle *handle = rb_entry(n, struct ion_handle,
 						     node);
-		if (handle->buffer == buffer)
+		if (buffer < handle->buffer)
+			n = n->rb_left;
+		else if (buffer > handle->buffer)
+			n = n->rb_right;
+		else
 			return handle;
 	}
 	return NULL;
 }
 
-static bool ion_handle_validate(struct ion_client *client, struct ion_handle *handle)
+/*
+ * Handles are handed out as kernel pointers, so one coming back from a
+ * caller may point anywhere. Read its id without trusting the pointer and
+ * check that the client's idr maps that id back to the same handle.
+ * Must be called under rcu_read_lock().
+ */
+static bool ion_handle_find(struct ion_client *client,
+			    struct ion_handle *handle)
 {
-	struct rb_node *n = client->handles.rb_node;
+	int id;
 
-	while (n) {
-		struct ion_handle *handle_node = rb_entry(n, struct ion_handle,
-							  node);
-		if (handle < handle_node)
-			n = n->rb_left;
-		else if (handle > handle_node)
-			n = n->rb_right;
-		else
-			return true;
-	}
-	return false;
+	if (!handle || !virt_addr_valid(&handle->id) ||
+	    probe_kernel_read(&id, &handle->id, sizeof(id)) || id <= 0)
+		return false;
+	return idr_find(&client->idr, id) == handle;
+}
+
+static bool ion_handle_validate(struct ion_client *client,
+				struct ion_handle *handle)
+{
+	bool valid;
+
+	rcu_read_lock();
+	valid = ion_handle_find(client, handle);
+	rcu_read_unlock();
+	return valid;
+}
+
+/*
+ * Validate a handle and take a reference on it so it cannot be freed
+ * under the caller, who must drop it with ion_handle_put().
+ */
+static struct ion_handle *ion_handle_get_checked(struct ion_client *client,
+						 struct ion_handle *handle)
+{
+	rcu_read_lock();
+	if (!ion_handle_find(client, handle) ||
+	    !atomic_inc_not_zero(&handle->ref.refcount))
+		handle = NULL;
+	rcu_read_unlock();
+	return handle;
 }
 
 static bool ion_handle_validate_frm_dev(struct ion_device *dev,
 					struct ion_handle *handle)
 {
-	struct rb_node **p;
-	struct rb_node *parent = NULL;
 	struct ion_client *client;
 	struct rb_node *n;
+	bool valid = false;
 
-	p = &dev->user_clients.rb_node;
-	while (*p) {
-		parent = *p;
-		client = rb_entry(parent, struct ion_client, node);
-
-		n = client->handles.rb_node;
-		while (n) {
-			struct ion_handle *handle_node =
-					rb_entry(n, struct ion_handle, node);
-			if (handle < handle_node)
-				n = n->rb_left;
-			else if (handle > handle_node)
-				n = n->rb_right;
-			else
-				return true;
-		}
+	mutex_lock(&dev->lock);
+	for (n = rb_first(&dev->user_clients); n && !valid; n = rb_next(n)) {
+		client = rb_entry(n, struct ion_client, node);
+		valid = ion_handle_validate(client, handle);
 	}
-	return false;
+	mutex_unlock(&dev->lock);
+	return valid;
 }
 
-static void ion_handle_add(struct ion_client *client, struct ion_handle *handle)
+/* this function should only be called while client->lock is held */
+static int ion_handle_add(struct ion_client *client, struct ion_handle *handle)
 {
 	struct rb_node **p = &client->handles.rb_node;
 	struct rb_node *parent = NULL;
 	struct ion_handle *entry;
+	int id;
+	int ret;
+
+	do {
+		if (!idr_pre_get(&client->idr, GFP_KERNEL))
+			return -ENOMEM;
+		ret = idr_get_new_above(&client->idr, handle, 1, &id);
+	} while (ret == -EAGAIN);
+	if (ret)
+		return ret;
+	handle->id = id;
 
 	while (*p) {
 		parent = *p;
 		entry = rb_entry(parent, struct ion_handle, node);
 
-		if (handle < entry)
+		if (handle->buffer < entry->buffer) {
 			p = &(*p)->rb_left;
-		else if (handle > entry)
+		} else {
+			WARN(handle->buffer == entry->buffer,
+			     "%s: buffer already found.", __func__);
 			p = &(*p)->rb_right;
-		else
-			WARN(1, "%s: buffer already found.", __func__);
+		}
 	}
 
 	rb_link_node(&handle->node, parent, p);
 	rb_insert_color(&handle->node, &client->handles);
+	return 0;
 }
 
 struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
@@ -246,6 +297,7 @@ struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
 	struct ion_handle *handle;
 	struct ion_device *dev = client->dev;
 	struct ion_buffer *buffer = NULL;
+	int ret;
 
 	/*
 	 * traverse the list of heaps available in this system in priority
@@ -253,7 +305,7 @@ struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
 	 * request of the caller allocate from it.  Repeat until allocate has
 	 * succeeded or all heaps have been tried
 	 */
-	mutex_lock(&dev->lock);
+	down_read(&dev->heap_lock);
 	for (n = rb_first(&dev->heaps); n != NULL; n = rb_next(n)) {
 		struct ion_heap *heap = rb_entry(n, struct ion_heap, node);
 		/* if the client doesn't support this heap type */
@@ -266,7 +318,7 @@ struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
 		if (!IS_ERR_OR_NULL(buffer))
 			break;
 	}
-	mutex_unlock(&dev->lock);
+	up_read(&dev->heap_lock);
 
 	if (IS_ERR_OR_NULL(buffer))
 		return ERR_PTR(PTR_ERR(buffer));
@@ -283,8 +335,12 @@ struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
 	ion_buffer_put(buffer);
 
 	mutex_lock(&client->lock);
-	ion_handle_add(client, handle);
+	ret = ion_handle_add(client, handle);
 	mutex_unlock(&client->lock);
+	if (ret) {
+		ion_handle_put(handle);
+		return ERR_PTR(ret);
+	}
 	return handle;
 
 end:
@@ -301,9 +357,7 @@ void ion_free(struct ion_client *client, struct ion_handle *handle)
 		return;
 	BUG_ON(client != handle->client);
 
-	mutex_lock(&client->lock);
 	valid_handle = ion_handle_validate(client, handle);
-	mutex_unlock(&client->lock);
 
 	if (!valid_handle) {
 		WARN("%s: invalid handle passed to free.\n", __func__);
@@ -351,22 +405,19 @@ int ion_phys(struct ion_client *client, struct ion_handle *handle,
 	struct ion_buffer *buffer;
 	int ret;
 
-	mutex_lock(&client->lock);
-	if (!ion_handle_validate(client, handle)) {
-		mutex_unlock(&client->lock);
+	if (!ion_handle_get_checked(client, handle))
 		return -EINVAL;
-	}
 
 	buffer = handle->buffer;
 
 	if (!buffer->heap->ops->phys) {
 		pr_err("%s: ion_phys is not implemented by this heap.\n",
 		       __func__);
-		mutex_unlock(&client->lock);
+		ion_handle_put(handle);
 		return -ENODEV;
 	}
-	mutex_unlock(&client->lock);
 	ret = buffer->heap->ops->phys(buffer->heap, buffer, addr, len);
+	ion_handle_put(handle);
 	return ret;
 }
 EXPORT_SYMBOL(ion_phys);
@@ -401,11 +452,9 @@ void *ion_map_kernel(struct ion_client *client, struct ion_handle *handle)
 	struct ion_buffer *buffer;
 	void *vaddr;
 
-	mutex_lock(&client->lock);
-	if (!ion_handle_validate(client, handle)) {
+	if (!ion_handle_get_checked(client, handle)) {
 		pr_err("%s: invalid handle passed to map_kernel.\n",
 		       __func__);
-		mutex_unlock(&client->lock);
 		return ERR_PTR(-EINVAL);
 	}
 
@@ -416,7 +465,7 @@ void *ion_map_kernel(struct ion_client *client, struct ion_handle *handle)
 		pr_err("%s: map_kernel is not implemented by this heap.\n",
 		       __func__);
 		mutex_unlock(&buffer->lock);
-		mutex_unlock(&client->lock);
+		ion_handle_put(handle);
 		return ERR_PTR(-ENODEV);
 	}
 
@@ -429,7 +478,7 @@ void *ion_map_kernel(struct ion_client *client, struct ion_handle *handle)
 		vaddr = buffer->vaddr;
 	}
 	mutex_unlock(&buffer->lock);
-	mutex_unlock(&client->lock);
+	ion_handle_put(handle);
 	return vaddr;
 }
 EXPORT_SYMBOL(ion_map_kernel);
@@ -440,11 +489,9 @@ struct scatterlist *ion_map_dma(struct ion_client *client,
 	struct ion_buffer *buffer;
 	struct scatterlist *sglist;
 
-	mutex_lock(&client->lock);
-	if (!ion_handle_validate(client, handle)) {
+	if (!ion_handle_get_checked(client, handle)) {
 		pr_err("%s: invalid handle passed to map_dma.\n",
 		       __func__);
-		mutex_unlock(&client->lock);
 		return ERR_PTR(-EINVAL);
 	}
 	buffer = handle->buffer;
@@ -454,7 +501,7 @@ struct scatterlist *ion_map_dma(struct ion_client *client,
 		pr_err("%s: map_kernel is not implemented by this heap.\n",
 		       __func__);
 		mutex_unlock(&buffer->lock);
-		mutex_unlock(&client->lock);
+		ion_handle_put(handle);
 		return ERR_PTR(-ENODEV);
 	}
 	if (_ion_map(&buffer->dmap_cnt, &handle->dmap_cnt)) {
@@ -466,7 +513,7 @@ struct scatterlist *ion_map_dma(struct ion_client *client,
 		sglist = buffer->sglist;
 	}
 	mutex_unlock(&buffer->lock);
-	mutex_unlock(&client->lock);
+	ion_handle_put(handle);
 	return sglist;
 }
 EXPORT_SYMBOL(ion_map_dma);
@@ -475,7 +522,6 @@ void ion_unmap_kernel(struct ion_client *client, struct ion_handle *handle)
 {
 	struct ion_buffer *buffer;
 
-	mutex_lock(&client->lock);
 	buffer = handle->buffer;
 	mutex_lock(&buffer->lock);
 	if (_ion_unmap(&buffer->kmap_cnt, &handle->kmap_cnt)) {
@@ -483,7 +529,6 @@ void ion_unmap_kernel(struct ion_client *client, struct ion_handle *handle)
 		buffer->vaddr = NULL;
 	}
 	mutex_unlock(&buffer->lock);
-	mutex_unlock(&client->lock);
 }
 EXPORT_SYMBOL(ion_unmap_kernel);
 
@@ -491,7 +536,6 @@ void ion_unmap_dma(struct ion_client *client, struct ion_handle *handle)
 {
 	struct ion_buffer *buffer;
 
-	mutex_lock(&client->lock);
 	buffer = handle->buffer;
 	mutex_lock(&buffer->lock);
 	if (_ion_unmap(&buffer->dmap_cnt, &handle->dmap_cnt)) {
@@ -499,19 +543,15 @@ void ion_unmap_dma(struct ion_client *client, struct ion_handle *handle)
 		buffer->sglist = NULL;
 	}
 	mutex_unlock(&buffer->lock);
-	mutex_unlock(&client->lock);
 }
 EXPORT_SYMBOL(ion_unmap_dma);
 
 struct ion_buffer *ion_share(struct ion_client *client,
 				 struct ion_handle *handle)
 {
-	bool valid_handle;
+	struct ion_buffer *buffer;
 
-	mutex_lock(&client->lock);
-	valid_handle = ion_handle_validate(client, handle);
-	mutex_unlock(&client->lock);
-	if (!valid_handle) {
+	if (!ion_handle_get_checked(client, handle)) {
 		WARN("%s: invalid handle passed to share.\n", __func__);
 		return ERR_PTR(-EINVAL);
 	}
@@ -521,7 +561,9 @@ struct ion_buffer *ion_share(struct ion_client *client,
 	 * to another client -- ion_free should not be called on this handle
 	 * until the buffer has been imported into the other client
 	 */
-	return handle->buffer;
+	buffer = handle->buffer;
+	ion_handle_put(handle);
+	return buffer;
 }
 EXPORT_SYMBOL(ion_share);
 
@@ -529,18 +571,27 @@ struct ion_handle *ion_import(struct ion_client *client,
 			      struct ion_buffer *buffer)
 {
 	struct ion_handle *handle = NULL;
+	int ret;
 
 	mutex_lock(&client->lock);
 	/* if a handle exists for this buffer just take a reference to it */
 	handle = ion_handle_lookup(client, buffer);
-	if (!IS_ERR_OR_NULL(handle)) {
-		ion_handle_get(handle);
-		goto end;
+	if (handle) {
+		if (atomic_inc_not_zero(&handle->ref.refcount))
+			goto end;
+		/* it is being destroyed, let a new handle take its place */
+		rb_erase(&handle->node, &client->handles);
+		rb_init_node(&handle->node);
 	}
 	handle = ion_handle_create(client, buffer);
 	if (IS_ERR_OR_NULL(handle))
 		goto end;
-	ion_handle_add(client, handle);
+	ret = ion_handle_add(client, handle);
+	if (ret) {
+		mutex_unlock(&client->lock);
+		ion_handle_put(handle);
+		return ERR_PTR(ret);
+	}
 end:
 	mutex_unlock(&client->lock);
 	return handle;
@@ -679,6 +730,7 @@ struct ion_client *ion_client_create(struct ion_device *dev,
 
 	client->dev = dev;
 	client->handles = RB_ROOT;
+	idr_init(&client->idr);
 	mutex_init(&client->lock);
 	client->name = name;
 	client->heap_mask = heap_mask;
@@ -737,6 +789,7 @@ static void _ion_client_destroy(struct kref *kref)
 						     node);
 		ion_handle_destroy(&handle->ref);
 	}
+	idr_destroy(&client->idr);
 	mutex_lock(&dev->lock);
 	if (client->task) {
 		rb_erase(&client->node, &dev->user_clients);
@@ -1015,15 +1068,11 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	case ION_IOC_FREE:
 	{
 		struct ion_handle_data data;
-		bool valid;
 
 		if (copy_from_user(&data, (void __user *)arg,
 				   sizeof(struct ion_handle_data)))
 			return -EFAULT;
-		mutex_lock(&client->lock);
-		valid = ion_handle_validate(client, data.handle);
-		mutex_unlock(&client->lock);
-		if (!valid)
+		if (!ion_handle_validate(client, data.handle))
 			return -EINVAL;
 		ion_free(client, data.handle);
 		break;
@@ -1035,18 +1084,16 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		mutex_lock(&client->lock);
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_get_checked(client, data.handle)) {
 			pr_err("%s: invalid handle passed to share ioctl.\n",
 			       __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 
 		if (cmd == ION_IOC_MAP)
 			data.handle->buffer->map_cacheable = data.cacheable;
 		data.fd = ion_ioctl_share(filp, client, data.handle);
-		mutex_unlock(&client->lock);
+		ion_handle_put(data.handle);
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
 			return -EFAULT;
 		break;
@@ -1085,16 +1132,14 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		mutex_lock(&client->lock);
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_get_checked(client, data.handle)) {
 			pr_err("%s: invalid handle passed to share ioctl.\n",
 			       __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 		data.handle->buffer->map_cacheable = data.map_cacheable;
 		data.fd = ion_ioctl_share(filp, client, data.handle);
-		mutex_unlock(&client->lock);
+		ion_handle_put(data.handle);
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
 			return -EFAULT;
 		break;
@@ -1123,14 +1168,14 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_get_checked(client, data.handle)) {
 			pr_err("%s: invalid handle passed to cache flush "
 				"ioctl.\n", __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 
 		ret = ion_flush_cached(data.handle, data.size, data.vaddr);
+		ion_handle_put(data.handle);
 		if (ret)
 			return ret;
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
@@ -1145,14 +1190,14 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_get_checked(client, data.handle)) {
 			pr_err("%s: invalid handle passed to cache inval"
 				" ioctl.\n", __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 
 		ret = ion_inval_cached(data.handle, data.size, data.vaddr);
+		ion_handle_put(data.handle);
 		if (ret)
 			return ret;
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
@@ -1244,6 +1289,11 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 		seq_printf(s, "%16.s %16u %16u\n", client->name, client->pid,
 			   size);
 	}
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		seq_printf(s, "%16s %33zu\n", "deferred free",
+			   ion_heap_freelist_size(heap));
+	if (heap->ops->debug_show)
+		heap->ops->debug_show(heap, s);
 	return 0;
 }
 
@@ -1266,7 +1316,7 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 	struct ion_heap *entry;
 
 	heap->dev = dev;
-	mutex_lock(&dev->lock);
+	down_write(&dev->heap_lock);
 	while (*p) {
 		parent = *p;
 		entry = rb_entry(parent, struct ion_heap, node);
@@ -1282,12 +1332,16 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 		}
 	}
 
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE &&
+	    ion_heap_init_deferred_free(heap))
+		heap->flags &= ~ION_HEAP_FLAG_DEFER_FREE;
+
 	rb_link_node(&heap->node, parent, p);
 	rb_insert_color(&heap->node, &dev->heaps);
 	debugfs_create_file(heap->name, 0664, dev->debug_root, heap,
 			    &debug_heap_fops);
 end:
-	mutex_unlock(&dev->lock);
+	up_write(&dev->heap_lock);
 }
 
 struct ion_device *ion_device_create(long (*custom_ioctl)
@@ -1318,7 +1372,9 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 
 	idev->custom_ioctl = custom_ioctl;
 	idev->buffers = RB_ROOT;
+	spin_lock_init(&idev->buffer_lock);
 	mutex_init(&idev->lock);
+	init_rwsem(&idev->heap_lock);
 	idev->heaps = RB_ROOT;
 	idev->user_clients = RB_ROOT;
 	idev->kernel_clients = RB_ROOT;
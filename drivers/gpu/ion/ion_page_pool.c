@@ -0,0 +1,174 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "ion_priv.h"
+
+static void ion_page_pool_zero(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		clear_highpage(page + i);
+}
+
+/*
+ * Pages come back to the pool dirty; clear them outside of the free path so
+ * the next allocation can hand them out directly.
+ */
+static void ion_page_pool_zero_work(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  zero_work);
+	struct page *page;
+
+	mutex_lock(&pool->lock);
+	while (pool->dirty_count) {
+		page = list_first_entry(&pool->dirty_items, struct page, lru);
+		list_del(&page->lru);
+		pool->dirty_count--;
+		mutex_unlock(&pool->lock);
+
+		ion_page_pool_zero(page, pool->order);
+		cond_resched();
+
+		mutex_lock(&pool->lock);
+		list_add_tail(&page->lru, &pool->clean_items);
+		pool->clean_count++;
+		pool->zeroed++;
+	}
+	mutex_unlock(&pool->lock);
+}
+
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+	bool dirty = false;
+
+	mutex_lock(&pool->lock);
+	if (pool->clean_count) {
+		page = list_first_entry(&pool->clean_items, struct page, lru);
+		pool->clean_count--;
+	} else if (pool->dirty_count) {
+		page = list_first_entry(&pool->dirty_items, struct page, lru);
+		pool->dirty_count--;
+		dirty = true;
+	}
+	if (page) {
+		list_del(&page->lru);
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	mutex_unlock(&pool->lock);
+
+	if (!page)
+		return alloc_pages(pool->gfp_mask, pool->order);
+	if (dirty)
+		ion_page_pool_zero(page, pool->order);
+	return page;
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	mutex_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->dirty_items);
+	pool->dirty_count++;
+	mutex_unlock(&pool->lock);
+	queue_work(system_unbound_wq, &pool->zero_work);
+}
+
+/* returns the number of PAGE_SIZE pages held by the pool */
+int ion_page_pool_total(struct ion_page_pool *pool)
+{
+	int count;
+
+	mutex_lock(&pool->lock);
+	count = (pool->clean_count + pool->dirty_count) << pool->order;
+	mutex_unlock(&pool->lock);
+	return count;
+}
+
+/*
+ * Release up to nr_to_scan PAGE_SIZE pages back to the system, dirty ones
+ * first since they would still cost a clear to reuse. Returns the number
+ * of pages freed.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	struct page *page;
+	int freed = 0;
+
+	while (freed < nr_to_scan) {
+		mutex_lock(&pool->lock);
+		if (pool->dirty_count) {
+			page = list_first_entry(&pool->dirty_items,
+						struct page, lru);
+			pool->dirty_count--;
+		} else if (pool->clean_count) {
+			page = list_first_entry(&pool->clean_items,
+						struct page, lru);
+			pool->clean_count--;
+		} else {
+			mutex_unlock(&pool->lock);
+			break;
+		}
+		list_del(&page->lru);
+		mutex_unlock(&pool->lock);
+
+		__free_pages(page, pool->order);
+		freed += 1 << pool->order;
+	}
+	return freed;
+}
+
+void ion_page_pool_debug_show(struct ion_page_pool *pool, struct seq_file *s)
+{
+	mutex_lock(&pool->lock);
+	seq_printf(s, "order %2u: %6d clean %6d dirty %10lu hits %10lu misses"
+		   " %10lu zeroed\n", pool->order, pool->clean_count,
+		   pool->dirty_count, pool->hits, pool->misses, pool->zeroed);
+	mutex_unlock(&pool->lock);
+}
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool = kzalloc(sizeof(struct ion_page_pool),
+					     GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	INIT_LIST_HEAD(&pool->clean_items);
+	INIT_LIST_HEAD(&pool->dirty_items);
+	mutex_init(&pool->lock);
+	INIT_WORK(&pool->zero_work, ion_page_pool_zero_work);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	cancel_work_sync(&pool->zero_work);
+	ion_page_pool_shrink(pool, INT_MAX);
+	kfree(pool);
+}
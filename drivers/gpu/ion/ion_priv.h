@@ -17,12 +17,21 @@
 #ifndef _ION_PRIV_H
 #define _ION_PRIV_H
 
+#include <linux/idr.h>
 #include <linux/kref.h>
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/ion.h>
 #include <linux/miscdevice.h>
+#include <linux/workqueue.h>
+
+struct seq_file;
 
 struct ion_mapping;
 
@@ -40,14 +49,19 @@ struct ion_kernel_mapping {
  * struct ion_device - the metadata of the ion device node
  * @dev:		the actual misc device
  * @buffers:	an rb tree of all the existing buffers
- * @lock:		lock protecting the buffers & heaps trees
+ * @buffer_lock:	lock protecting the buffers tree
+ * @lock:		lock protecting the client trees
+ * @heap_lock:		lock protecting the heaps tree, held for reading across
+ *			allocations so heaps can allocate concurrently
  * @heaps:		list of all the heaps in the system
  * @user_clients:	list of all the clients created from userspace
  */
 struct ion_device {
 	struct miscdevice dev;
 	struct rb_root buffers;
+	spinlock_t buffer_lock;
 	struct mutex lock;
+	struct rw_semaphore heap_lock;
 	struct rb_root heaps;
 	long (*custom_ioctl) (struct ion_client *client, unsigned int cmd,
 			      unsigned long arg);
@@ -61,21 +75,26 @@ struct ion_device {
  * @ref:		for reference counting the client
  * @node:		node in the tree of all clients
  * @dev:		backpointer to ion device
- * @handles:		an rb tree of all the handles in this client
- * @lock:		lock protecting the tree of handles
+ * @handles:		an rb tree of all the handles in this client, keyed
+ *			by buffer
+ * @idr:		handles by id, for lockless validation of handles
+ *			passed in by callers
+ * @lock:		lock protecting the tree of handles and idr updates
  * @heap_mask:		mask of all supported heaps
  * @name:		used for debugging
  * @task:		used for debugging
  *
  * A client represents a list of buffers this client may access.
- * The mutex stored here is used to protect both handles tree
- * as well as the handles themselves, and should be held while modifying either.
+ * The mutex stored here is used to protect the handles tree and idr, and
+ * should be held while modifying either. Lookups in the idr only need
+ * rcu_read_lock().
  */
 struct ion_client {
 	struct kref ref;
 	struct rb_node node;
 	struct ion_device *dev;
 	struct rb_root handles;
+	struct idr idr;
 	struct mutex lock;
 	unsigned int heap_mask;
 	const char *name;
@@ -90,18 +109,23 @@ struct ion_client {
  * @client:		back pointer to the client the buffer resides in
  * @buffer:		pointer to the buffer
  * @node:		node in the client's handle rbtree
+ * @id:			id in the client's idr, 0 until the handle is added
+ * @rcu:		handles are freed after a grace period for idr lookups
  * @kmap_cnt:		count of times this client has mapped to kernel
  * @dmap_cnt:		count of times this client has mapped for dma
  * @usermap_cnt:	count of times this client has mapped for userspace
  *
- * Modifications to node, map_cnt or mapping should be protected by the
- * lock in the client.  Other fields are never changed after initialization.
+ * Modifications to node and id should be protected by the lock in the
+ * client, the map counts by the lock in the buffer.  Other fields are
+ * never changed after initialization.
  */
 struct ion_handle {
 	struct kref ref;
 	struct ion_client *client;
 	struct ion_buffer *buffer;
 	struct rb_node node;
+	int id;
+	struct rcu_head rcu;
 	unsigned int kmap_cnt;
 	unsigned int dmap_cnt;
 	unsigned int usermap_cnt;
@@ -113,6 +137,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * struct ion_buffer - metadata for a particular buffer
  * @ref:		refernce count
  * @node:		node in the ion_device buffers tree
+ * @list:		element in the heap's deferred free list
  * @dev:		back pointer to the ion_device
  * @heap:		back pointer to the heap the buffer came from
  * @flags:		buffer specific flags
@@ -121,7 +146,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  *			a void *
  * @priv_phys:		private data to the buffer representable as
  *			an ion_phys_addr_t (and someday a phys_addr_t)
- * @lock:		protects the buffers cnt fields
+ * @lock:		protects the buffers cnt fields and those of its handles
  * @kmap_cnt:		number of times the buffer is mapped to the kernel
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
@@ -130,6 +155,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 struct ion_buffer {
 	struct kref ref;
 	struct rb_node node;
+	struct list_head list;
 	struct ion_device *dev;
 	struct ion_heap *heap;
 	unsigned long flags;
@@ -159,6 +185,7 @@ struct ion_buffer {
  * @map_user		map memory to userspace
  * @flush_user		flush memory if mapped as cacheable
  * @inval_user		invalidate memory if mapped as cacheable
+ * @debug_show		show heap specific state in the heap's debugfs file
  */
 struct ion_heap_ops {
 	int (*allocate) (struct ion_heap *heap,
@@ -178,8 +205,14 @@ struct ion_heap_ops {
 			unsigned long vaddr);
 	int (*inval_user) (struct ion_buffer *buffer, size_t len,
 			unsigned long vaddr);
+	void (*debug_show) (struct ion_heap *heap, struct seq_file *s);
 };
 
+/**
+ * heap flags - flags between the heaps and core ion code
+ */
+#define ION_HEAP_FLAG_DEFER_FREE (1 << 0)
+
 /**
  * struct ion_heap - represents a heap in the system
  * @node:		rb node to put the heap on the device's tree of heaps
@@ -191,6 +224,14 @@ struct ion_heap_ops {
  *			MUST be unique
  * @name:		used for debugging
  * @priv:		private heap data
+ * @flags:		flags, ION_HEAP_FLAG_DEFER_FREE makes the last put of a
+ *			buffer queue it for a kernel thread instead of calling
+ *			ops->free inline
+ * @free_list:		buffers waiting to be freed
+ * @free_list_size:	total size in bytes of buffers on free_list
+ * @free_lock:		protects free_list and free_list_size
+ * @waitqueue:		wakes the deferred free thread
+ * @task:		the deferred free thread
  *
  * Represents a pool of memory from which buffers can be made.  In some
  * systems the only heap is regular system memory allocated via vmalloc.
@@ -205,6 +246,12 @@ struct ion_heap {
 	int id;
 	const char *name;
 	void *priv;
+	unsigned long flags;
+	struct list_head free_list;
+	size_t free_list_size;
+	spinlock_t free_lock;
+	wait_queue_head_t waitqueue;
+	struct task_struct *task;
 };
 
 /**
@@ -231,6 +278,50 @@ void ion_device_destroy(struct ion_device *dev);
  */
 void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap);
 
+/**
+ * ion_buffer_release - hand a buffer's memory back to its heap and free it
+ * @buffer:		the buffer, already removed from the device
+ */
+void ion_buffer_release(struct ion_buffer *buffer);
+
+/**
+ * ion_heap_init_freelist - set up the free list of a heap
+ * @heap:		a heap with ION_HEAP_FLAG_DEFER_FREE set
+ *
+ * Must be called when the heap is created, before anything, such as its
+ * shrinker, can look at the free list.
+ */
+void ion_heap_init_freelist(struct ion_heap *heap);
+
+/**
+ * ion_heap_init_deferred_free - start the deferred free thread of a heap
+ * @heap:		a heap with ION_HEAP_FLAG_DEFER_FREE set
+ */
+int ion_heap_init_deferred_free(struct ion_heap *heap);
+
+/**
+ * ion_heap_freelist_add - queue a buffer for the deferred free thread
+ * @heap:		the heap
+ * @buffer:		the buffer
+ */
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer);
+
+/**
+ * ion_heap_freelist_drain - free buffers from the deferred list synchronously
+ * @heap:		the heap
+ * @size:		amount of memory to release, 0 for everything
+ *
+ * Returns the number of bytes released, which may exceed @size since whole
+ * buffers are freed.
+ */
+size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size);
+
+/**
+ * ion_heap_freelist_size - bytes currently waiting on the deferred list
+ * @heap:		the heap
+ */
+size_t ion_heap_freelist_size(struct ion_heap *heap);
+
 /**
  * functions for creating and destroying the built in ion heaps.
  * architectures can add their own custom architecture specific
@@ -262,6 +353,46 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  */
 #define ION_CARVEOUT_ALLOCATE_FAIL -1
 
+/**
+ * struct ion_page_pool - pagepool struct
+ * @clean_count:	number of zeroed items in the pool
+ * @dirty_count:	number of items in the pool still to be zeroed
+ * @clean_items:	list of zeroed pages
+ * @dirty_items:	list of pages waiting for the zeroing worker
+ * @lock:		lock protecting this struct and the lists
+ * @gfp_mask:		gfp_mask to use when the pool is empty
+ * @order:		order of pages in the pool
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that went to the page allocator
+ * @zeroed:		pages cleared by the background worker
+ * @zero_work:		background zeroing of dirty_items
+ *
+ * Allows you to keep a pool of pre-zeroed pages of a given order around
+ * for fast allocation. Freed pages are zeroed in the background; an
+ * allocation that finds only dirty pages clears one synchronously.
+ */
+struct ion_page_pool {
+	int clean_count;
+	int dirty_count;
+	struct list_head clean_items;
+	struct list_head dirty_items;
+	struct mutex lock;
+	gfp_t gfp_mask;
+	unsigned int order;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long zeroed;
+	struct work_struct zero_work;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+int ion_page_pool_total(struct ion_page_pool *pool);
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan);
+void ion_page_pool_debug_show(struct ion_page_pool *pool, struct seq_file *s);
+
 /**
  * Flushing entire cache is more efficient than flushing virtual address
  * range of a buffer whose size is 200Kbytes or higher, since line by
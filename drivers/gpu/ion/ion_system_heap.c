@@ -18,50 +18,134 @@
 #include <linux/ion.h>
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include "ion_priv.h"
 
+/*
+ * Buffers are built from the largest chunks that fit, 1M then 64K then
+ * single pages, each order backed by its own page pool. High-order
+ * attempts do not retry or warn; once an order fails, the rest of the
+ * buffer is built from smaller chunks.
+ */
+static const unsigned int orders[] = {8, 4, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+static const gfp_t high_order_gfp_flags = (GFP_KERNEL | __GFP_HIGHMEM |
+					   __GFP_ZERO | __GFP_NOWARN |
+					   __GFP_NORETRY) & ~__GFP_WAIT;
+static const gfp_t low_order_gfp_flags = GFP_KERNEL | __GFP_HIGHMEM |
+					 __GFP_ZERO;
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool *pools[NUM_ORDERS];
+	struct shrinker shrinker;
+};
+
+static int order_to_index(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (order == orders[i])
+			return i;
+	BUG();
+	return -1;
+}
+
+static struct page *alloc_largest_available(struct ion_system_heap *heap,
+					    unsigned long size,
+					    unsigned int *max_order)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (size < (PAGE_SIZE << orders[i]))
+			continue;
+		if (orders[i] > *max_order)
+			continue;
+
+		page = ion_page_pool_alloc(heap->pools[i]);
+		if (!page)
+			continue;
+		*max_order = orders[i];
+		return page;
+	}
+	return NULL;
+}
+
+/*
+ * The order of each chunk is kept in page_private() of its first page so
+ * the free path can return it to the right pool.
+ */
+static void ion_system_heap_free_pages(struct ion_system_heap *heap,
+				       struct page **page_list, int n_pages)
+{
+	int i = 0;
+
+	while (i < n_pages) {
+		struct page *page = page_list[i];
+		unsigned int order = page_private(page);
+
+		set_page_private(page, 0);
+		ion_page_pool_free(heap->pools[order_to_index(order)], page);
+		i += 1 << order;
+	}
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    unsigned long size, unsigned long align,
 				    unsigned long flags)
 {
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
 	int n_pages = PAGE_ALIGN(size) / PAGE_SIZE;
+	unsigned long size_remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
 	struct page **page_list;
-	const int gfp_mask = GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO;
 	int i = 0;
 
 	page_list = kmalloc(n_pages * sizeof(void *), GFP_KERNEL);
+	if (!page_list)
+		return -ENOMEM;
+
+	while (size_remaining > 0) {
+		struct page *page;
+		int j;
 
-	for (i = 0; i < n_pages; i++) {
-		page_list[i] = alloc_page(gfp_mask);
-		if (page_list[i] == NULL)
+		page = alloc_largest_available(sys_heap, size_remaining,
+					       &max_order);
+		if (!page)
 			goto out;
+		set_page_private(page, max_order);
+		for (j = 0; j < (1 << max_order); j++)
+			page_list[i++] = page + j;
+		size_remaining -= PAGE_SIZE << max_order;
 	}
 
 	buffer->priv_virt = page_list;
 	return 0;
 
 out:
-	/* failed on i, so go to i-1 */
-	i--;
-
-	for (; i >= 0; i--)
-		__free_page(page_list[i]);
-
+	ion_system_heap_free_pages(sys_heap, page_list, i);
 	kfree(page_list);
 	return -ENOMEM;
 }
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
-	int i;
+	struct ion_system_heap *sys_heap = container_of(buffer->heap,
+							struct ion_system_heap,
+							heap);
 	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
 	struct page **page_list = (struct page **)buffer->priv_virt;
 
-	for (i = 0; i < n_pages; i++)
-		__free_page(page_list[i]);
+	ion_system_heap_free_pages(sys_heap, page_list, n_pages);
 	kfree(page_list);
 }
 
@@ -113,30 +197,80 @@ int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 {
 	unsigned long uaddr = vma->vm_start;
 	unsigned long usize = vma->vm_end - vma->vm_start;
-	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+	unsigned long n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
 	struct page **page_list = (struct page **)buffer->priv_virt;
-	int i;
+	unsigned long i = vma->vm_pgoff;
+
+	/*
+	 * Buffers are made of non-compound high-order chunks whose tail
+	 * pages carry no reference count, so they are mapped by pfn rather
+	 * than with vm_insert_page(). A pfn mapping cannot be copied on
+	 * write, so only shared mappings are allowed.
+	 */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
 
-	if (usize /* + pgoff << PAGE_SHIFT */  > (n_pages << PAGE_SHIFT))
+	if (i >= n_pages || usize > (n_pages - i) << PAGE_SHIFT)
 		return -EINVAL;
 
-	i = 0;
 	do {
 		int ret;
 
-		ret = vm_insert_page(vma, uaddr, page_list[i]);
+		ret = remap_pfn_range(vma, uaddr, page_to_pfn(page_list[i]),
+				      PAGE_SIZE, vma->vm_page_prot);
 		if (ret)
 			return ret;
 
+		i++;
 		uaddr += PAGE_SIZE;
 		usize -= PAGE_SIZE;
 	} while (usize > 0);
 
-	vma->vm_flags |= VM_RESERVED;
-
 	return 0;
 }
 
+static int ion_system_heap_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct ion_system_heap *sys_heap = container_of(shrinker,
+							struct ion_system_heap,
+							shrinker);
+	int nr_to_scan = sc->nr_to_scan;
+	int nr_total = 0;
+	int i;
+
+	/* buffers still waiting on the free thread come back via the pools */
+	if (nr_to_scan > 0 &&
+	    (sys_heap->heap.flags & ION_HEAP_FLAG_DEFER_FREE))
+		ion_heap_freelist_drain(&sys_heap->heap,
+					(size_t)nr_to_scan * PAGE_SIZE);
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		struct ion_page_pool *pool = sys_heap->pools[i];
+
+		if (nr_to_scan > 0)
+			nr_to_scan -= ion_page_pool_shrink(pool, nr_to_scan);
+		nr_total += ion_page_pool_total(pool);
+	}
+	if (sys_heap->heap.flags & ION_HEAP_FLAG_DEFER_FREE)
+		nr_total += ion_heap_freelist_size(&sys_heap->heap) /
+			    PAGE_SIZE;
+	return nr_total;
+}
+
+static void ion_system_heap_debug_show(struct ion_heap *heap,
+				       struct seq_file *s)
+{
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	int i;
+
+	seq_printf(s, "\npage pools:\n");
+	for (i = 0; i < NUM_ORDERS; i++)
+		ion_page_pool_debug_show(sys_heap->pools[i], s);
+}
+
 static struct ion_heap_ops vmalloc_ops = {
 	.allocate = ion_system_heap_allocate,
 	.free = ion_system_heap_free,
@@ -145,23 +279,54 @@ static struct ion_heap_ops vmalloc_ops = {
 	.map_kernel = ion_system_heap_map_kernel,
 	.unmap_kernel = ion_system_heap_unmap_kernel,
 	.map_user = ion_system_heap_map_user,
+	.debug_show = ion_system_heap_debug_show,
 };
 
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *heap;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
+	heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
 	if (!heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	heap->heap.ops = &vmalloc_ops;
+	heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+	heap->heap.flags = ION_HEAP_FLAG_DEFER_FREE;
+	ion_heap_init_freelist(&heap->heap);
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		gfp_t gfp_flags = orders[i] > 0 ? high_order_gfp_flags :
+						  low_order_gfp_flags;
+
+		heap->pools[i] = ion_page_pool_create(gfp_flags, orders[i]);
+		if (!heap->pools[i])
+			goto err_create_pool;
+	}
+
+	heap->shrinker.shrink = ion_system_heap_shrink;
+	heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&heap->shrinker);
+	return &heap->heap;
+
+err_create_pool:
+	while (--i >= 0)
+		ion_page_pool_destroy(heap->pools[i]);
+	kfree(heap);
+	return ERR_PTR(-ENOMEM);
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	int i;
+
+	unregister_shrinker(&sys_heap->shrinker);
+	for (i = 0; i < NUM_ORDERS; i++)
+		ion_page_pool_destroy(sys_heap->pools[i]);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
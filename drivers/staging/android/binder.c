@@ -34,17 +34,39 @@
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 #include <linux/security.h>
+#include <linux/ktime.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
+/*
+ * Locking:
+ *
+ * binder_main_lock protects the node/ref graph (proc->nodes, proc->refs_*,
+ * binder_dead_nodes, binder_context_mgr_node), the todo lists, the thread
+ * trees and the transaction stacks. It is only held for short sections;
+ * the buffer allocator of each proc, including page allocation/mapping and
+ * the copy of the transaction payload, runs under proc->alloc_lock with
+ * binder_main_lock dropped.
+ *
+ * Lock order: binder_main_lock -> proc->alloc_lock -> mm->mmap_sem
+ */
+static DEFINE_MUTEX(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 static DEFINE_MUTEX(binder_mmap_lock);
+static DECLARE_WAIT_QUEUE_HEAD(binder_release_wait);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
 
+/* buffer pages that are mapped but not used by any buffer, oldest first */
+static LIST_HEAD(binder_page_lru);
+static DEFINE_SPINLOCK(binder_page_lru_lock);
+static int binder_page_lru_count;
+
 static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
@@ -149,7 +171,7 @@ enum binder_stat_types {
 
 struct binder_stats {
 	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	int bc[_IOC_NR(BC_REPLY_SG) + 1];
 	int obj_created[BINDER_STAT_COUNT];
 	int obj_deleted[BINDER_STAT_COUNT];
 };
@@ -186,6 +208,67 @@ struct binder_transaction_log {
 static struct binder_transaction_log binder_transaction_log;
 static struct binder_transaction_log binder_transaction_log_failed;
 
+struct binder_lock_stats {
+	unsigned long acquired;
+	unsigned long contended;
+	u64 wait_ns;
+};
+
+static struct binder_lock_stats binder_main_lock_stats;
+
+static void binder_mutex_lock(struct mutex *lock,
+			      struct binder_lock_stats *stats,
+			      const char *tag)
+{
+	if (!mutex_trylock(lock)) {
+		ktime_t start = ktime_get();
+		s64 wait_ns;
+
+		mutex_lock(lock);
+		wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		stats->contended++;
+		stats->wait_ns += wait_ns;
+		trace_binder_lock_contended(tag, wait_ns);
+	} else {
+		trace_binder_lock_acquire(tag);
+	}
+	stats->acquired++;
+}
+
+static inline void binder_lock(void)
+{
+	binder_mutex_lock(&binder_main_lock, &binder_main_lock_stats, "main");
+}
+
+/*
+ * Latency histograms: log2 buckets in microseconds. Bucket 0 counts
+ * samples below 1us, bucket n samples in [2^(n-1), 2^n) us and the last
+ * bucket everything above.
+ */
+#define BINDER_LATENCY_BUCKETS 24
+
+enum binder_latency_stage {
+	BINDER_LATENCY_DELIVER,		/* send -> receive */
+	BINDER_LATENCY_HANDLE,		/* receive -> reply */
+	BINDER_LATENCY_ROUND_TRIP,	/* send -> reply received */
+	BINDER_LATENCY_COUNT
+};
+
+static const char * const binder_latency_strings[] = {
+	"deliver",
+	"handle",
+	"round trip"
+};
+
+struct binder_latency_hist {
+	unsigned long bucket[BINDER_LATENCY_COUNT][BINDER_LATENCY_BUCKETS];
+};
+
+static inline void binder_unlock(void)
+{
+	mutex_unlock(&binder_main_lock);
+}
+
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
@@ -258,20 +341,28 @@ struct binder_ref {
 	struct binder_ref_death *death;
 };
 
+struct binder_lru_page {
+	struct list_head lru;	/* on binder_page_lru while unused */
+	struct page *page;
+	struct binder_proc *proc;
+};
+
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
 	struct rb_node rb_node; /* free entry by size or allocated entry */
 				/* by address */
 	unsigned free:1;
-	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
-	unsigned debug_id:29;
+	unsigned debug_id:30;
+	/* not a bitfield, set on delivery without alloc_lock */
+	unsigned allow_user_free;
 
 	struct binder_transaction *transaction;
 
 	struct binder_node *target_node;
 	size_t data_size;
 	size_t offsets_size;
+	size_t extra_buffers_size;
 	uint8_t data[0];
 };
 
@@ -296,14 +387,23 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex alloc_lock;
+	struct binder_lock_stats alloc_lock_stats;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
+	struct mm_struct *vma_vm_mm;
+	int pages_cached;
+	unsigned long page_hits;
+	unsigned long page_misses;
+	unsigned long pages_reclaimed;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	atomic_t tmp_refs;
+	int is_dead;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
@@ -313,6 +413,7 @@ struct binder_proc {
 	int requested_threads_started;
 	int ready_threads;
 	long default_priority;
+	struct binder_latency_hist latency;
 	struct dentry *debugfs_entry;
 };
 
@@ -356,12 +457,50 @@ struct binder_transaction {
 	unsigned int	flags;
 	long	priority;
 	long	saved_priority;
+	int	sched_policy;
+	int	rt_priority;
+	int	saved_sched_policy;
+	int	saved_rt_priority;
+	ktime_t	enqueue_time;
+	/* for replies, the start of the call being replied to */
+	ktime_t	start_time;
+	ktime_t	recv_time;
 	uid_t	sender_euid;
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+static inline void binder_alloc_lock(struct binder_proc *proc)
+{
+	binder_mutex_lock(&proc->alloc_lock, &proc->alloc_lock_stats,
+			  "alloc");
+}
+
+static inline void binder_alloc_unlock(struct binder_proc *proc)
+{
+	mutex_unlock(&proc->alloc_lock);
+}
+
+/*
+ * tmp_refs pins a proc that is used with binder_main_lock dropped, by
+ * transactions copying into its buffer area and by the page shrinker. The
+ * deferred release waits for it to drop to zero before tearing down the
+ * buffer area, and again before freeing the proc.
+ */
+static void binder_proc_inc_tmpref(struct binder_proc *proc)
+{
+	atomic_inc(&proc->tmp_refs);
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	/* atomic_dec_and_test() orders the drop before the queue check */
+	if (atomic_dec_and_test(&proc->tmp_refs) &&
+	    waitqueue_active(&binder_release_wait))
+		wake_up(&binder_release_wait);
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -517,6 +656,108 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static inline int binder_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static void binder_set_sched_policy(int policy, int rt_priority)
+{
+	struct sched_param param = { .sched_priority = rt_priority };
+
+	if (current->policy == policy && current->rt_priority == rt_priority)
+		return;
+	if (sched_setscheduler_nocheck(current, policy, &param))
+		binder_user_error("binder: %d failed to set policy %d "
+				  "priority %d\n", current->pid, policy,
+				  rt_priority);
+}
+
+/*
+ * Run the receiving thread at the priority of the caller for the
+ * duration of a synchronous transaction. Real-time callers hand their
+ * policy down to the binder thread, everybody else only their nice
+ * value, bounded by the node's min_priority as before.
+ */
+static void binder_inherit_priority(struct binder_transaction *t,
+				    struct binder_node *target_node)
+{
+	t->saved_priority = task_nice(current);
+	t->saved_sched_policy = current->policy;
+	t->saved_rt_priority = current->rt_priority;
+
+	if (t->flags & TF_ONE_WAY) {
+		if (t->saved_priority > target_node->min_priority)
+			binder_set_nice(target_node->min_priority);
+		return;
+	}
+	if (binder_rt_policy(t->sched_policy)) {
+		if (!binder_rt_policy(current->policy) ||
+		    current->rt_priority < t->rt_priority)
+			binder_set_sched_policy(t->sched_policy,
+						t->rt_priority);
+		return;
+	}
+	if (t->priority < target_node->min_priority)
+		binder_set_nice(t->priority);
+	else
+		binder_set_nice(target_node->min_priority);
+}
+
+static void binder_restore_priority(struct binder_transaction *t)
+{
+	binder_set_sched_policy(t->saved_sched_policy, t->saved_rt_priority);
+	binder_set_nice(t->saved_priority);
+}
+
+/*
+ * Effective priority a transaction is queued with, on the same scale as
+ * task_struct->prio: lower values are more urgent.
+ */
+static int binder_transaction_prio(struct binder_transaction *t)
+{
+	if (binder_rt_policy(t->sched_policy))
+		return MAX_RT_PRIO - 1 - t->rt_priority;
+	return MAX_RT_PRIO + 20 + t->priority;
+}
+
+/*
+ * Queue a transaction on a todo list behind all work that is at least as
+ * urgent. Only pending transactions are overtaken; other work items keep
+ * their place, so death notifications and ref updates are never
+ * reordered against the transactions that were queued before them.
+ */
+static void binder_enqueue_transaction(struct binder_transaction *t,
+				       struct list_head *target_list)
+{
+	struct list_head *pos;
+	int prio = binder_transaction_prio(t);
+
+	list_for_each_prev(pos, target_list) {
+		struct binder_work *w;
+
+		w = list_entry(pos, struct binder_work, entry);
+		if (w->type != BINDER_WORK_TRANSACTION)
+			break;
+		if (binder_transaction_prio(container_of(w,
+		    struct binder_transaction, work)) <= prio)
+			break;
+	}
+	t->enqueue_time = ktime_get();
+	list_add(&t->work.entry, pos);
+}
+
+static void binder_latency_add(struct binder_proc *proc,
+			       enum binder_latency_stage stage, ktime_t start)
+{
+	u64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+	int i = fls64(us);
+
+	if (i >= BINDER_LATENCY_BUCKETS)
+		i = BINDER_LATENCY_BUCKETS - 1;
+	proc->latency.bucket[stage][i]++;
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -609,6 +850,61 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+/*
+ * Unmap and free a cached buffer page. Called from the shrinker with
+ * proc->alloc_lock held and the page off the LRU. Returns -EBUSY if the
+ * user mapping could not be torn down without blocking.
+ */
+static int binder_free_lru_page(struct binder_proc *proc,
+				struct binder_lru_page *lru_page)
+{
+	void *page_addr = proc->buffer + (lru_page - proc->pages) * PAGE_SIZE;
+	struct mm_struct *mm = proc->vma_vm_mm;
+
+	/*
+	 * If the mm has no users left the process is exiting and the user
+	 * mapping goes away with exit_mmap().
+	 */
+	if (mm && atomic_inc_not_zero(&mm->mm_users)) {
+		if (!down_read_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return -EBUSY;
+		}
+		if (proc->vma)
+			zap_page_range(proc->vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(lru_page->page);
+	lru_page->page = NULL;
+	return 0;
+}
+
+static void binder_lru_page_get(struct binder_proc *proc,
+				struct binder_lru_page *lru_page)
+{
+	spin_lock(&binder_page_lru_lock);
+	BUG_ON(list_empty(&lru_page->lru));
+	list_del_init(&lru_page->lru);
+	binder_page_lru_count--;
+	spin_unlock(&binder_page_lru_lock);
+	proc->pages_cached--;
+	proc->page_hits++;
+}
+
+static void binder_lru_page_put(struct binder_proc *proc,
+				struct binder_lru_page *lru_page)
+{
+	spin_lock(&binder_page_lru_lock);
+	BUG_ON(!list_empty(&lru_page->lru));
+	list_add_tail(&lru_page->lru, &binder_page_lru);
+	binder_page_lru_count++;
+	spin_unlock(&binder_page_lru_lock);
+	proc->pages_cached++;
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -616,6 +912,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
+	struct binder_lru_page *lru_page;
 	struct page **page;
 	struct mm_struct *mm;
 
@@ -626,6 +923,26 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0)
+		goto free_range;
+
+	/*
+	 * Pages released by earlier buffers stay mapped on the LRU until
+	 * the shrinker takes them, so a hot process normally gets all its
+	 * pages back without touching the mm at all.
+	 */
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		lru_page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (!lru_page->page)
+			break;
+	}
+	if (page_addr >= end) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			binder_lru_page_get(proc, &proc->pages[
+				(page_addr - proc->buffer) / PAGE_SIZE]);
+		return 0;
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -641,9 +958,6 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
@@ -653,9 +967,14 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
 		int ret;
 		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		lru_page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		page = &lru_page->page;
 
-		BUG_ON(*page);
+		if (*page) {
+			binder_lru_page_get(proc, lru_page);
+			continue;
+		}
+		proc->page_misses++;
 		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -689,20 +1008,17 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(*page);
+	*page = NULL;
 err_alloc_page_failed:
-		;
+	/* the pages already populated are still good, cache them */
+	while (page_addr > start) {
+		page_addr -= PAGE_SIZE;
+		binder_lru_page_put(proc, &proc->pages[
+			(page_addr - proc->buffer) / PAGE_SIZE]);
 	}
 err_no_vma:
 	if (mm) {
@@ -710,11 +1026,67 @@ err_no_vma:
 		mmput(mm);
 	}
 	return -ENOMEM;
+
+free_range:
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+		binder_lru_page_put(proc, &proc->pages[
+			(page_addr - proc->buffer) / PAGE_SIZE]);
+	return 0;
 }
 
+/*
+ * Give cached buffer pages back under memory pressure, coldest first.
+ * Only trylocks are taken since we may be called from any allocation.
+ */
+static int binder_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct binder_lru_page *lru_page;
+	struct binder_proc *proc;
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	int count;
+
+	spin_lock(&binder_page_lru_lock);
+	while (nr_to_scan-- && !list_empty(&binder_page_lru)) {
+		lru_page = list_first_entry(&binder_page_lru,
+					    struct binder_lru_page, lru);
+		proc = lru_page->proc;
+		list_move_tail(&lru_page->lru, &binder_page_lru);
+		if (!mutex_trylock(&proc->alloc_lock))
+			continue;
+		/* the release may free proc as soon as alloc_lock is dropped */
+		binder_proc_inc_tmpref(proc);
+		list_del_init(&lru_page->lru);
+		binder_page_lru_count--;
+		spin_unlock(&binder_page_lru_lock);
+
+		if (binder_free_lru_page(proc, lru_page)) {
+			spin_lock(&binder_page_lru_lock);
+			list_add_tail(&lru_page->lru, &binder_page_lru);
+			binder_page_lru_count++;
+		} else {
+			proc->pages_cached--;
+			proc->pages_reclaimed++;
+			spin_lock(&binder_page_lru_lock);
+		}
+		mutex_unlock(&proc->alloc_lock);
+		binder_proc_dec_tmpref(proc);
+	}
+	count = binder_page_lru_count;
+	spin_unlock(&binder_page_lru_lock);
+
+	return count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
-					      size_t offsets_size, int is_async)
+					      size_t offsets_size,
+					      size_t extra_buffers_size,
+					      int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -722,7 +1094,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
 	void *end_page_addr;
-	size_t size;
+	size_t size, data_offsets_size;
 
 	if (proc->vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
@@ -730,14 +1102,22 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	size = ALIGN(data_size, sizeof(void *)) +
+	data_offsets_size = ALIGN(data_size, sizeof(void *)) +
 		ALIGN(offsets_size, sizeof(void *));
 
-	if (size < data_size || size < offsets_size) {
+	if (data_offsets_size < data_size ||
+	    data_offsets_size < offsets_size) {
 		binder_user_error("binder: %d: got transaction with invalid "
 			"size %zd-%zd\n", proc->pid, data_size, offsets_size);
 		return NULL;
 	}
+	size = data_offsets_size + ALIGN(extra_buffers_size, sizeof(void *));
+	if (size < data_offsets_size || size < extra_buffers_size) {
+		binder_user_error("binder: %d: got transaction with invalid "
+			"extra_buffers_size %zd\n", proc->pid,
+			extra_buffers_size);
+		return NULL;
+	}
 
 	if (is_async &&
 	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
@@ -806,6 +1186,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		     "%p\n", proc->pid, size, buffer);
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
+	buffer->extra_buffers_size = extra_buffers_size;
 	buffer->async_transaction = is_async;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
@@ -883,11 +1264,15 @@ static void binder_free_buf(struct binder_proc *proc,
 	buffer_size = binder_buffer_size(proc, buffer);
 
 	size = ALIGN(buffer->data_size, sizeof(void *)) +
-		ALIGN(buffer->offsets_size, sizeof(void *));
+		ALIGN(buffer->offsets_size, sizeof(void *)) +
+		ALIGN(buffer->extra_buffers_size, sizeof(void *));
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_free_buf %p size %zd buffer"
 		     "_size %zd\n", proc->pid, buffer, size, buffer_size);
+	trace_binder_buffer_free(proc->pid, buffer->debug_id,
+				 buffer->data_size, buffer->offsets_size,
+				 buffer->extra_buffers_size);
 
 	BUG_ON(buffer->free);
 	BUG_ON(size > buffer_size);
@@ -1307,6 +1692,127 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	}
 }
 
+/*
+ * Returns the size of the object at @offset in @buffer, or 0 if the offset
+ * does not point at a complete, aligned object.
+ */
+static size_t binder_validate_object(struct binder_buffer *buffer,
+				     size_t offset)
+{
+	unsigned long type;
+	size_t object_size;
+
+	if (buffer->data_size < sizeof(type) ||
+	    offset > buffer->data_size - sizeof(type) ||
+	    !IS_ALIGNED(offset, sizeof(void *)))
+		return 0;
+
+	type = *(unsigned long *)(buffer->data + offset);
+	if (type == BINDER_TYPE_PTR)
+		object_size = sizeof(struct binder_buffer_object);
+	else
+		object_size = sizeof(struct flat_binder_object);
+
+	if (buffer->data_size < object_size ||
+	    offset > buffer->data_size - object_size)
+		return 0;
+	return object_size;
+}
+
+/*
+ * Copy the BINDER_TYPE_PTR buffers of a transaction into the space behind
+ * its offsets array, and point the objects, and the parents they are
+ * embedded in, at the copies in the target's address space. Called with
+ * only the target's alloc_lock held, so large scatter-gather payloads do
+ * not hold up the rest of the driver.
+ */
+static int binder_copy_sg_buffers(struct binder_proc *proc,
+				  struct binder_thread *thread,
+				  struct binder_proc *target_proc,
+				  struct binder_buffer *buffer)
+{
+	size_t *offp_start, *offp, *off_end;
+	size_t off_min = 0;
+	uint8_t *sg_bufp, *sg_buf_end;
+
+	/* a bad offsets size is rejected by binder_transaction() */
+	if (!IS_ALIGNED(buffer->offsets_size, sizeof(size_t)))
+		return 0;
+
+	offp_start = (size_t *)(buffer->data +
+				ALIGN(buffer->data_size, sizeof(void *)));
+	off_end = (void *)offp_start + buffer->offsets_size;
+	sg_bufp = (uint8_t *)offp_start +
+		ALIGN(buffer->offsets_size, sizeof(void *));
+	sg_buf_end = sg_bufp + buffer->extra_buffers_size;
+
+	for (offp = offp_start; offp < off_end; offp++) {
+		struct binder_buffer_object *bp, *parent;
+		size_t object_size;
+		void **fixup;
+
+		object_size = binder_validate_object(buffer, *offp);
+		if (!object_size)
+			continue;
+		/*
+		 * Objects must be in order and must not overlap, or a
+		 * buffer object could rewrite the parent it is fixed into.
+		 */
+		if (*offp < off_min) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"overlapping or unordered offset, %zd\n",
+				proc->pid, thread->pid, *offp);
+			return -EINVAL;
+		}
+		off_min = *offp + object_size;
+		bp = (struct binder_buffer_object *)(buffer->data + *offp);
+		if (bp->type != BINDER_TYPE_PTR)
+			continue;
+
+		if (bp->length > (size_t)(sg_buf_end - sg_bufp)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"too large buffer object, %zd\n",
+				proc->pid, thread->pid, bp->length);
+			return -EINVAL;
+		}
+		if (copy_from_user(sg_bufp, bp->buffer, bp->length)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid buffer object ptr\n",
+				proc->pid, thread->pid);
+			return -EFAULT;
+		}
+		bp->buffer = (void *)sg_bufp + target_proc->user_buffer_offset;
+		sg_bufp += ALIGN(bp->length, sizeof(void *));
+
+		if (!(bp->flags & BINDER_BUFFER_FLAG_HAS_PARENT))
+			continue;
+
+		if (bp->parent >= offp - offp_start ||
+		    !binder_validate_object(buffer, offp_start[bp->parent])) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid parent index, %zd\n",
+				proc->pid, thread->pid, bp->parent);
+			return -EINVAL;
+		}
+		parent = (struct binder_buffer_object *)
+			(buffer->data + offp_start[bp->parent]);
+		if (parent->type != BINDER_TYPE_PTR ||
+		    parent->length < sizeof(void *) ||
+		    bp->parent_offset > parent->length - sizeof(void *) ||
+		    !IS_ALIGNED(bp->parent_offset, sizeof(void *))) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid parent offset, %zd\n",
+				proc->pid, thread->pid, bp->parent_offset);
+			return -EINVAL;
+		}
+		fixup = (void **)((uint8_t *)parent->buffer -
+				  target_proc->user_buffer_offset +
+				  bp->parent_offset);
+		*fixup = bp->buffer;
+	}
+	return 0;
+}
+
 static void binder_transaction_buffer_release(struct binder_proc *proc,
 					      struct binder_buffer *buffer,
 					      size_t *failed_at)
@@ -1329,9 +1835,7 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 		off_end = (void *)offp + buffer->offsets_size;
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
-		if (*offp > buffer->data_size - sizeof(*fp) ||
-		    buffer->data_size < sizeof(*fp) ||
-		    !IS_ALIGNED(*offp, sizeof(void *))) {
+		if (!binder_validate_object(buffer, *offp)) {
 			printk(KERN_ERR "binder: transaction release %d bad"
 					"offset %zd, size %zd\n", debug_id,
 					*offp, buffer->data_size);
@@ -1374,6 +1878,10 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				task_close_fd(proc, fp->handle);
 			break;
 
+		case BINDER_TYPE_PTR:
+			/* copied into the buffer itself, nothing to release */
+			break;
+
 		default:
 			printk(KERN_ERR "binder: transaction release %d bad "
 			       "object type %lx\n", debug_id, fp->type);
@@ -1384,11 +1892,13 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+			       struct binder_transaction_data *tr, int reply,
+			       size_t extra_buffers_size)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
 	size_t *offp, *off_end;
+	size_t off_min;
 	struct binder_proc *target_proc;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
@@ -1415,7 +1925,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_restore_priority(in_reply_to);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1478,34 +1988,6 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_invalid_target_handle;
 		}
-		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
-			struct binder_transaction *tmp;
-			tmp = thread->transaction_stack;
-			if (tmp->to_thread != thread) {
-				binder_user_error("binder: %d:%d got new "
-					"transaction with bad transaction stack"
-					", transaction %d has target %d:%d\n",
-					proc->pid, thread->pid, tmp->debug_id,
-					tmp->to_proc ? tmp->to_proc->pid : 0,
-					tmp->to_thread ?
-					tmp->to_thread->pid : 0);
-				return_error = BR_FAILED_REPLY;
-				goto err_bad_call_stack;
-			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
-		}
-	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
 	}
 	e->to_proc = target_proc->pid;
 
@@ -1550,37 +2032,122 @@ static void binder_transaction(struct binder_proc *proc,
 		t->from = NULL;
 	t->sender_euid = proc->tsk->cred->euid;
 	t->to_proc = target_proc;
-	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	t->sched_policy = current->policy;
+	t->rt_priority = current->rt_priority;
+	if (reply)
+		t->start_time = in_reply_to->start_time;
+	else
+		t->start_time = ktime_get();
+
+	/*
+	 * Allocate the target buffer and copy the payload without holding
+	 * binder_main_lock. The target proc and node are pinned so they
+	 * cannot go away, and everything that depends on the graph is
+	 * revalidated once the lock is taken again.
+	 */
+	binder_proc_inc_tmpref(target_proc);
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+	return_error = BR_OK;
+	binder_unlock();
+
+	binder_alloc_lock(target_proc);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, extra_buffers_size,
+		!reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
-		goto err_binder_alloc_buf_failed;
+	} else {
+		t->buffer->allow_user_free = 0;
+		t->buffer->debug_id = t->debug_id;
+		trace_binder_buffer_alloc(target_proc->pid, t->debug_id,
+			tr->data_size, tr->offsets_size, extra_buffers_size);
+		t->buffer->transaction = t;
+		t->buffer->target_node = target_node;
+
+		offp = (size_t *)(t->buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+
+		if (copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+				   tr->data_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data ptr\n", proc->pid, thread->pid);
+			return_error = BR_FAILED_REPLY;
+		} else if (copy_from_user(offp, tr->data.ptr.offsets,
+					  tr->offsets_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets ptr\n", proc->pid,
+				thread->pid);
+			return_error = BR_FAILED_REPLY;
+		} else if (binder_copy_sg_buffers(proc, thread, target_proc,
+						  t->buffer)) {
+			return_error = BR_FAILED_REPLY;
+		}
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
-
-	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
+	binder_alloc_unlock(target_proc);
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
+	binder_lock();
+	if (t->buffer == NULL)
+		goto err_binder_alloc_buf_failed;
+	if (return_error != BR_OK)
 		goto err_copy_data_failed;
+
+	if (target_proc->is_dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+	if (reply) {
+		target_thread = in_reply_to->from;
+		if (target_thread == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			target_thread = NULL;
+			goto err_dead_target;
+		}
+	} else if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+		tmp = thread->transaction_stack;
+		if (tmp->to_thread != thread) {
+			binder_user_error("binder: %d:%d got new "
+				"transaction with bad transaction stack"
+				", transaction %d has target %d:%d\n",
+				proc->pid, thread->pid, tmp->debug_id,
+				tmp->to_proc ? tmp->to_proc->pid : 0,
+				tmp->to_thread ?
+				tmp->to_thread->pid : 0);
+			return_error = BR_FAILED_REPLY;
+			goto err_bad_target_stack;
+		}
+		while (tmp) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+			tmp = tmp->from_parent;
+		}
+	}
+	t->to_thread = target_thread;
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
 	}
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1589,17 +2156,20 @@ static void binder_transaction(struct binder_proc *proc,
 		goto err_bad_offset;
 	}
 	off_end = (void *)offp + tr->offsets_size;
+	off_min = 0;
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
-		if (*offp > t->buffer->data_size - sizeof(*fp) ||
-		    t->buffer->data_size < sizeof(*fp) ||
-		    !IS_ALIGNED(*offp, sizeof(void *))) {
+		size_t object_size;
+
+		object_size = binder_validate_object(t->buffer, *offp);
+		if (!object_size || *offp < off_min) {
 			binder_user_error("binder: %d:%d got transaction with "
 				"invalid offset, %zd\n",
 				proc->pid, thread->pid, *offp);
 			return_error = BR_FAILED_REPLY;
 			goto err_bad_offset;
 		}
+		off_min = *offp + object_size;
 		fp = (struct flat_binder_object *)(t->buffer->data + *offp);
 		switch (fp->type) {
 		case BINDER_TYPE_BINDER:
@@ -1731,6 +2301,10 @@ static void binder_transaction(struct binder_proc *proc,
 			fp->handle = target_fd;
 		} break;
 
+		case BINDER_TYPE_PTR:
+			/* already copied by binder_copy_sg_buffers() */
+			break;
+
 		default:
 			binder_user_error("binder: %d:%d got transactio"
 				"n with invalid object type, %lx\n",
@@ -1741,6 +2315,11 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		binder_latency_add(proc, BINDER_LATENCY_HANDLE,
+				   in_reply_to->recv_time);
+		trace_binder_reply(t->debug_id, proc->pid, thread->pid,
+				   target_proc->pid, target_thread->pid,
+				   t->code, t->flags);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1756,12 +2335,17 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	if (!reply)
+		trace_binder_transaction(t->debug_id, proc->pid, thread->pid,
+			target_proc->pid, target_thread ? target_thread->pid : 0,
+			t->code, t->flags);
 	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
+	binder_enqueue_transaction(t, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_proc_dec_tmpref(target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1772,11 +2356,18 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+err_bad_target_stack:
+err_dead_target:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
+	binder_alloc_lock(target_proc);
 	binder_free_buf(target_proc, t->buffer);
+	binder_alloc_unlock(target_proc);
 err_binder_alloc_buf_failed:
+	if (t->buffer == NULL && target_node)
+		binder_dec_node(target_node, 1, 0);
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1957,20 +2548,26 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			binder_alloc_lock(proc);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				binder_alloc_unlock(proc);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				binder_alloc_unlock(proc);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			/* claim the buffer before dropping alloc_lock */
+			buffer->allow_user_free = 0;
+			binder_alloc_unlock(proc);
 			binder_debug(BINDER_DEBUG_FREE_BUFFER,
 				     "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				     proc->pid, thread->pid, data_ptr, buffer->debug_id,
@@ -1988,7 +2585,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
+
+			/* unmapping the pages does not need the graph lock */
+			binder_unlock();
+			binder_alloc_lock(proc);
 			binder_free_buf(proc, buffer);
+			binder_alloc_unlock(proc);
+			binder_lock();
 			break;
 		}
 
@@ -1999,7 +2602,19 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY, 0);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			binder_transaction(proc, thread, &tr.transaction_data,
+					   cmd == BC_REPLY_SG, tr.buffers_size);
 			break;
 		}
 
@@ -2256,7 +2871,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2280,7 +2895,7 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_lock();
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2430,13 +3045,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_inherit_priority(t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2481,6 +3090,17 @@ retry:
 			     t->from ? t->from->pid : 0, cmd,
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
+		trace_binder_transaction_received(t->debug_id, proc->pid,
+			thread->pid, binder_transaction_prio(t),
+			ktime_to_ns(ktime_sub(ktime_get(), t->enqueue_time)));
+		if (cmd == BR_TRANSACTION) {
+			t->recv_time = ktime_get();
+			binder_latency_add(proc, BINDER_LATENCY_DELIVER,
+					   t->start_time);
+		} else {
+			binder_latency_add(proc, BINDER_LATENCY_ROUND_TRIP,
+					   t->start_time);
+		}
 
 		list_del(&t->work.entry);
 		t->buffer->allow_user_free = 1;
@@ -2622,12 +3242,12 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_lock();
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2659,7 +3279,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_lock();
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2771,7 +3391,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2813,6 +3433,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
 	struct binder_buffer *buffer;
+	int i;
 
 	if ((vma->vm_end - vma->vm_start) > SZ_4M)
 		vma->vm_end = vma->vm_start + SZ_4M;
@@ -2862,6 +3483,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2879,6 +3504,8 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	proc->free_async_space = proc->buffer_size / 2;
 	barrier();
 	proc->files = get_files_struct(proc->tsk);
+	atomic_inc(&vma->vm_mm->mm_count);
+	proc->vma_vm_mm = vma->vm_mm;
 	proc->vma = vma;
 
 	/*printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p\n",
@@ -2913,16 +3540,17 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	mutex_init(&proc->alloc_lock);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	binder_lock();
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2981,6 +3609,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	proc->is_dead = 1;
 	hlist_del(&proc->proc_node);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
@@ -3042,8 +3671,17 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
 
+	/* wait for senders still copying into our buffer area */
+	if (atomic_read(&proc->tmp_refs)) {
+		binder_unlock();
+		wait_event(binder_release_wait,
+			   atomic_read(&proc->tmp_refs) == 0);
+		binder_lock();
+	}
+
+	buffers = 0;
+	binder_alloc_lock(proc);
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3066,28 +3704,40 @@ static void binder_deferred_release(struct binder_proc *proc)
 	if (proc->pages) {
 		int i;
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			struct binder_lru_page *lru_page = &proc->pages[i];
+
+			if (lru_page->page) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
+
+				spin_lock(&binder_page_lru_lock);
+				if (!list_empty(&lru_page->lru)) {
+					list_del_init(&lru_page->lru);
+					binder_page_lru_count--;
+				}
+				spin_unlock(&binder_page_lru_lock);
 				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
+					     "page %d at %p freed\n",
 					     proc->pid, i,
 					     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				if (IS_ALIGNED((unsigned long)proc->pages[i],
+				if (IS_ALIGNED((unsigned long)lru_page->page,
 						4))
-					__free_page(proc->pages[i]);
+					__free_page(lru_page->page);
 				else
 					printk(KERN_ERR "binder_release: %d: "
 						"page %d addr %p is invalid\n",
-						proc->pid, i, proc->pages[i]);
+						proc->pid, i, lru_page->page);
 				page_count++;
 			}
 		}
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
+	binder_alloc_unlock(proc);
+	if (proc->vma_vm_mm)
+		mmdrop(proc->vma_vm_mm);
 
 	put_task_struct(proc->tsk);
 
@@ -3098,6 +3748,11 @@ static void binder_deferred_release(struct binder_proc *proc)
 		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
 		     active_transactions, buffers, page_count);
 
+	/*
+	 * The pages are off the LRU now, so no new shrinker reference can
+	 * be taken; wait for one that may still be unlocking alloc_lock.
+	 */
+	wait_event(binder_release_wait, atomic_read(&proc->tmp_refs) == 0);
 	kfree(proc);
 }
 
@@ -3108,7 +3763,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		binder_lock();
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3135,7 +3790,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3289,6 +3944,14 @@ static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
 		   ref->node->debug_id, ref->strong, ref->weak, ref->death);
 }
 
+static void print_binder_page_stats(struct seq_file *m,
+				    struct binder_proc *proc)
+{
+	seq_printf(m, "  pages: cached %d hits %lu misses %lu reclaimed %lu\n",
+		   proc->pages_cached, proc->page_hits, proc->page_misses,
+		   proc->pages_reclaimed);
+}
+
 static void print_binder_proc(struct seq_file *m,
 			      struct binder_proc *proc, int print_all)
 {
@@ -3300,6 +3963,8 @@ static void print_binder_proc(struct seq_file *m,
 	seq_printf(m, "proc %d\n", proc->pid);
 	header_pos = m->count;
 
+	if (print_all)
+		print_binder_page_stats(m, proc);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		print_binder_thread(m, rb_entry(n, struct binder_thread,
 						rb_node), print_all);
@@ -3316,9 +3981,13 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	if (!binder_debug_no_lock)
+		mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	if (!binder_debug_no_lock)
+		mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3367,7 +4036,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3414,6 +4085,14 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	}
 }
 
+static void print_binder_lock_stats(struct seq_file *m, const char *prefix,
+				    struct binder_lock_stats *stats)
+{
+	seq_printf(m, "%s: acquired %lu contended %lu wait %llu ns\n",
+		   prefix, stats->acquired, stats->contended,
+		   (unsigned long long)stats->wait_ns);
+}
+
 static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
@@ -3448,9 +4127,15 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	if (!binder_debug_no_lock)
+		mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	if (!binder_debug_no_lock)
+		mutex_unlock(&proc->alloc_lock);
 	seq_printf(m, "  buffers: %d\n", count);
+	print_binder_lock_stats(m, "  alloc lock", &proc->alloc_lock_stats);
+	print_binder_page_stats(m, proc);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3476,7 +4161,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder state:\n");
 
@@ -3488,7 +4173,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3499,16 +4184,57 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	print_binder_lock_stats(m, "main lock", &binder_main_lock_stats);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
+	return 0;
+}
+
+static void print_binder_latency(struct seq_file *m,
+				 struct binder_proc *proc)
+{
+	int stage, i;
+
+	seq_printf(m, "proc %d\n", proc->pid);
+	for (stage = 0; stage < BINDER_LATENCY_COUNT; stage++) {
+		unsigned long *bucket = proc->latency.bucket[stage];
+
+		seq_printf(m, "  %s:\n", binder_latency_strings[stage]);
+		for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+			if (!bucket[i])
+				continue;
+			if (i == 0)
+				seq_printf(m, "    %10s us: %lu\n", "< 1",
+					   bucket[i]);
+			else
+				seq_printf(m, "    %10lu us: %lu\n",
+					   1UL << (i - 1), bucket[i]);
+		}
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		binder_lock();
+
+	seq_puts(m, "binder latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
+		print_binder_latency(m, proc);
+	if (do_lock)
+		binder_unlock();
 	return 0;
 }
 
@@ -3519,13 +4245,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3535,11 +4261,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3587,6 +4313,7 @@ static struct miscdevice binder_miscdev = {
 BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
+BINDER_DEBUG_ENTRY(latency);
 BINDER_DEBUG_ENTRY(transaction_log);
 
 static int __init binder_init(void)
@@ -3602,6 +4329,7 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -3618,6 +4346,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    NULL,
 				    &binder_transactions_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 		debugfs_create_file("transaction_log",
 				    S_IRUGO,
 				    binder_debugfs_dir_entry_root,
@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PTR		= B_PACK_CHARS('p', 't', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -61,6 +62,31 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+enum {
+	BINDER_BUFFER_FLAG_HAS_PARENT = 0x01,
+};
+
+/*
+ * A buffer object describes a block of sender memory that is copied
+ * directly into the target's transaction buffer, behind the offsets
+ * array, by BC_TRANSACTION_SG and BC_REPLY_SG. The driver rewrites
+ * 'buffer' to point at the copy in the target's address space. If
+ * BINDER_BUFFER_FLAG_HAS_PARENT is set, 'parent' is the index in the
+ * offsets array of an earlier buffer object, and the pointer stored at
+ * 'parent_offset' in that buffer is patched to the new location too.
+ *
+ * Large payloads that live in ashmem or ion memory should not be copied
+ * at all; send the fd as a BINDER_TYPE_FD object and map it in the target.
+ */
+struct binder_buffer_object {
+	unsigned long		type;
+	unsigned long		flags;
+	void			*buffer;
+	size_t			length;
+	size_t			parent;
+	size_t			parent_offset;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
@@ -147,6 +173,11 @@ struct binder_transaction_data {
 	} data;
 };
 
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	size_t		buffers_size;	/* bytes of buffer objects */
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +355,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, with the total
+	 * size of the BINDER_TYPE_PTR buffers it carries.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
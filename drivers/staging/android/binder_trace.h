@@ -0,0 +1,160 @@
+/* binder_trace.h
+ *
+ * Copyright (C) 2012 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+#define TRACE_INCLUDE_FILE binder_trace
+
+DECLARE_EVENT_CLASS(binder_transaction_class,
+	TP_PROTO(int debug_id, int from_proc, int from_thread, int to_proc,
+		 int to_thread, unsigned int code, unsigned int flags),
+	TP_ARGS(debug_id, from_proc, from_thread, to_proc, to_thread, code,
+		flags),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, from_proc)
+		__field(int, from_thread)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->from_proc = from_proc;
+		__entry->from_thread = from_thread;
+		__entry->to_proc = to_proc;
+		__entry->to_thread = to_thread;
+		__entry->code = code;
+		__entry->flags = flags;
+	),
+	TP_printk("transaction=%d from=%d:%d dest=%d:%d code=0x%x flags=0x%x",
+		  __entry->debug_id, __entry->from_proc, __entry->from_thread,
+		  __entry->to_proc, __entry->to_thread, __entry->code,
+		  __entry->flags)
+);
+
+DEFINE_EVENT(binder_transaction_class, binder_transaction,
+	TP_PROTO(int debug_id, int from_proc, int from_thread, int to_proc,
+		 int to_thread, unsigned int code, unsigned int flags),
+	TP_ARGS(debug_id, from_proc, from_thread, to_proc, to_thread, code,
+		flags));
+
+DEFINE_EVENT(binder_transaction_class, binder_reply,
+	TP_PROTO(int debug_id, int from_proc, int from_thread, int to_proc,
+		 int to_thread, unsigned int code, unsigned int flags),
+	TP_ARGS(debug_id, from_proc, from_thread, to_proc, to_thread, code,
+		flags));
+
+/*
+ * Emitted when a thread picks a transaction off its todo list. prio is
+ * the effective priority the transaction was queued with (lower is more
+ * urgent, same scale as task_struct->prio) and delay_ns is the time it
+ * spent on the todo list.
+ */
+TRACE_EVENT(binder_transaction_received,
+	TP_PROTO(int debug_id, int to_proc, int to_thread, int prio,
+		 s64 delay_ns),
+	TP_ARGS(debug_id, to_proc, to_thread, prio, delay_ns),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(int, prio)
+		__field(s64, delay_ns)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->to_proc = to_proc;
+		__entry->to_thread = to_thread;
+		__entry->prio = prio;
+		__entry->delay_ns = delay_ns;
+	),
+	TP_printk("transaction=%d dest_proc=%d dest_thread=%d prio=%d delay_ns=%lld",
+		  __entry->debug_id, __entry->to_proc, __entry->to_thread,
+		  __entry->prio, __entry->delay_ns)
+);
+
+DECLARE_EVENT_CLASS(binder_buffer_class,
+	TP_PROTO(int proc, int debug_id, size_t data_size,
+		 size_t offsets_size, size_t extra_buffers_size),
+	TP_ARGS(proc, debug_id, data_size, offsets_size, extra_buffers_size),
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(int, debug_id)
+		__field(size_t, data_size)
+		__field(size_t, offsets_size)
+		__field(size_t, extra_buffers_size)
+	),
+	TP_fast_assign(
+		__entry->proc = proc;
+		__entry->debug_id = debug_id;
+		__entry->data_size = data_size;
+		__entry->offsets_size = offsets_size;
+		__entry->extra_buffers_size = extra_buffers_size;
+	),
+	TP_printk("proc=%d transaction=%d data_size=%zd offsets_size=%zd extra_buffers_size=%zd",
+		  __entry->proc, __entry->debug_id, __entry->data_size,
+		  __entry->offsets_size, __entry->extra_buffers_size)
+);
+
+DEFINE_EVENT(binder_buffer_class, binder_buffer_alloc,
+	TP_PROTO(int proc, int debug_id, size_t data_size,
+		 size_t offsets_size, size_t extra_buffers_size),
+	TP_ARGS(proc, debug_id, data_size, offsets_size, extra_buffers_size));
+
+DEFINE_EVENT(binder_buffer_class, binder_buffer_free,
+	TP_PROTO(int proc, int debug_id, size_t data_size,
+		 size_t offsets_size, size_t extra_buffers_size),
+	TP_ARGS(proc, debug_id, data_size, offsets_size, extra_buffers_size));
+
+TRACE_EVENT(binder_lock_acquire,
+	TP_PROTO(const char *lock),
+	TP_ARGS(lock),
+	TP_STRUCT__entry(
+		__string(lock, lock)
+	),
+	TP_fast_assign(
+		__assign_str(lock, lock);
+	),
+	TP_printk("lock=%s", __get_str(lock))
+);
+
+/* Emitted instead of binder_lock_acquire when the caller had to sleep */
+TRACE_EVENT(binder_lock_contended,
+	TP_PROTO(const char *lock, s64 wait_ns),
+	TP_ARGS(lock, wait_ns),
+	TP_STRUCT__entry(
+		__string(lock, lock)
+		__field(s64, wait_ns)
+	),
+	TP_fast_assign(
+		__assign_str(lock, lock);
+		__entry->wait_ns = wait_ns;
+	),
+	TP_printk("lock=%s wait_ns=%lld", __get_str(lock), __entry->wait_ns)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
@@ -21,10 +21,12 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -35,18 +37,36 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers never take a lock. w_off, c_off and head are free-running byte
+ * counters that are only reduced modulo the size when the buffer is
+ * accessed. A writer reserves its entry by advancing w_off with cmpxchg,
+ * moves head past the entries it is about to overwrite, copies the entry
+ * in and then commits it by advancing c_off. Commits happen in reservation
+ * order, and everything below c_off is complete. The whole sequence runs
+ * with preemption disabled, so writers never wait on a sleeping writer.
+ *
+ * Readers copy an entry out and then check that w_off has not lapped it in
+ * the meantime, so they need no synchronization with writers either. The
+ * mutex 'mutex' only protects the list of readers and their state.
+ *
+ * Every entry in the ring is preceded by a sequence number that is
+ * assigned at commit time. Readers use it to tell how many entries they
+ * lost when they were lapped; the total for the log is kept in 'dropped'.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
+	struct mutex		mutex;	/* mutex protecting readers */
+	size_t			w_off;	/* end of the last reservation */
+	size_t			c_off;	/* end of the last committed entry */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	u32			c_seq;	/* sequence number of the next commit */
+	atomic_long_t		dropped; /* entries lost by lapped readers */
 };
 
 /*
@@ -60,9 +80,24 @@ struct logger_reader {
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
 	bool			r_all;	/* reader can read all entries */
+	bool			r_batch; /* read() returns as many as fit */
 	int			r_ver;	/* reader ABI version */
+	bool			r_seq_valid; /* r_seq is known */
+	u32			r_seq;	/* sequence number expected at r_off */
+	unsigned long		dropped; /* entries this reader lost */
+	struct logger_entry	*entry;	/* copy of the entry at r_off */
 };
 
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/* bytes an entry with a payload of 'len' bytes takes up in the ring */
+#define logger_entry_size(len) \
+	(sizeof(u32) + sizeof(struct logger_entry) + (len))
+
+/* per-CPU staging buffer for the payload of the entry being written */
+static DEFINE_PER_CPU(unsigned char [LOGGER_ENTRY_MAX_PAYLOAD], logger_stage);
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -90,39 +125,102 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_header - returns a pointer to the logger_entry header within
- * 'log' starting at offset 'off'. A temporary logger_entry 'scratch' must
- * be provided. Typically the return value will be a pointer within
- * 'logger->buf'.  However, a pointer to 'scratch' may be returned if
- * the log entry spans the end and beginning of the circular buffer.
+ * do_read_log - copies 'count' bytes at the free-running offset 'off' of
+ * 'log' to 'buf', wrapping around the end of the ring as needed
  */
-static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+static void do_read_log(struct logger_log *log, size_t off, void *buf,
+			size_t count)
 {
-	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
+	size_t len;
+
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
+
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+/*
+ * do_write_log - writes 'count' bytes from 'buf' to the free-running offset
+ * 'off' of 'log', wrapping around the end of the ring as needed
+ *
+ * The caller needs to own the reservation covering the bytes.
+ */
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
+{
+	size_t len;
+
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
+
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
+}
 
-	return (struct logger_entry *) (log->buffer + off);
+/*
+ * is_lapped - has the writer reserved space over the entry at 'off'?
+ */
+static inline bool is_lapped(struct logger_log *log, size_t off)
+{
+	return ACCESS_ONCE(log->w_off) - off > log->size;
 }
 
 /*
- * get_entry_msg_len - Grabs the length of the message of the entry
- * starting from from 'off'.
+ * peek_entry - copies the next entry readable by 'reader' into
+ * reader->entry and returns 0, or returns -EAGAIN if there is none.
+ *
+ * Entries the reader is not allowed to see are skipped, and a reader that
+ * was lapped by the writer is pulled forward to the oldest entry.
  *
  * Caller needs to hold log->mutex.
  */
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
+static int peek_entry(struct logger_log *log, struct logger_reader *reader)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	struct logger_entry *entry = reader->entry;
+
+	for (;;) {
+		size_t off = reader->r_off;
+		size_t len;
+		u32 seq;
+
+		if (off == ACCESS_ONCE(log->c_off))
+			return -EAGAIN;
+		smp_rmb();
+
+		if (is_lapped(log, off)) {
+			reader->r_off = ACCESS_ONCE(log->head);
+			cpu_relax();
+			continue;
+		}
 
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+		do_read_log(log, off, &seq, sizeof(u32));
+		do_read_log(log, off + sizeof(u32), entry,
+			    sizeof(struct logger_entry));
+		len = min_t(size_t, entry->len, LOGGER_ENTRY_MAX_PAYLOAD);
+		do_read_log(log, off + sizeof(u32) +
+			    sizeof(struct logger_entry), entry->msg, len);
+
+		/* the copy is only good if nobody wrote over it meanwhile */
+		smp_rmb();
+		if (is_lapped(log, off))
+			continue;
+
+		if (reader->r_seq_valid && seq != reader->r_seq) {
+			reader->dropped += seq - reader->r_seq;
+			atomic_long_add(seq - reader->r_seq, &log->dropped);
+		}
+		reader->r_seq = seq;
+		reader->r_seq_valid = true;
+
+		if (reader->r_all || entry->euid == current_euid())
+			return 0;
+
+		reader->r_off = off + logger_entry_size(entry->len);
+		reader->r_seq++;
+	}
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -158,78 +256,29 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log_to_user - copies the entry that peek_entry() found into the
+ * user-space buffer 'buf' and moves the reader past it. Returns the number
+ * of bytes copied on success.
  *
  * Caller must hold log->mutex.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+				   char __user *buf)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
-	size_t len;
-	size_t msg_start;
+	struct logger_entry *entry = reader->entry;
 
-	/*
-	 * First, copy the header to userspace, using the version of
-	 * the header requested
-	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
 	if (copy_header_to_user(reader->r_ver, entry, buf))
 		return -EFAULT;
 
-	count -= get_user_hdr_len(reader->r_ver);
 	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(reader->r_off + sizeof(struct logger_entry));
-
-	/*
-	 * We read from the msg in two disjoint operations. First, we read from
-	 * the current msg head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
+	if (copy_to_user(buf, entry->msg, entry->len))
 		return -EFAULT;
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
-
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
+	reader->r_off += logger_entry_size(entry->len);
+	reader->r_seq++;
 
-	return count + get_user_hdr_len(reader->r_ver);
-}
-
-/*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
- */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
-{
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
-
-		entry = get_entry_header(log, off, &scratch);
-
-		if (entry->euid == euid)
-			return off;
-
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(off + next_len);
-	}
-
-	return off;
+	return get_user_hdr_len(reader->r_ver) + entry->len;
 }
 
 /*
@@ -239,7 +288,8 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in batch mode as many
+ * 	  whole entries as fit into the buffer
  *
  * Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -256,9 +306,7 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = (ACCESS_ONCE(log->c_off) == reader->r_off);
 		if (!ret)
 			break;
 
@@ -281,26 +329,34 @@ start:
 
 	mutex_lock(&log->mutex);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(peek_entry(log, reader))) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + reader->entry->len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(log, reader, buf);
+
+	/* ... and in batch mode, whatever else fits */
+	while (reader->r_batch && ret > 0 && !peek_entry(log, reader)) {
+		ssize_t nr = get_user_hdr_len(reader->r_ver) +
+			reader->entry->len;
+
+		if (count - ret < nr)
+			break;
+		nr = do_read_log_to_user(log, reader, buf + ret);
+		if (nr < 0)
+			break;
+		ret += nr;
+	}
 
 out:
 	mutex_unlock(&log->mutex);
@@ -309,131 +365,139 @@ out:
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * advance_head - moves log->head past every entry that a reservation
+ * ending at 'end' is going to overwrite
  *
- * Caller must hold log->mutex.
+ * Called with preemption disabled. Only entries that are committed are
+ * ever skipped, and the cmpxchg makes sure that an entry header which
+ * another writer already reused is never acted upon.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void advance_head(struct logger_log *log, size_t end)
 {
-	size_t count = 0;
+	for (;;) {
+		size_t head = ACCESS_ONCE(log->head);
+		struct logger_entry entry;
 
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+		if (end - head <= log->size)
+			break;
 
-	return off;
-}
+		if (head == ACCESS_ONCE(log->c_off)) {
+			cpu_relax();
+			continue;
+		}
+		smp_rmb();
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+		do_read_log(log, head + sizeof(u32), &entry,
+			    sizeof(struct logger_entry));
+		cmpxchg(&log->head, head, head + logger_entry_size(entry.len));
 	}
-
-	return 0;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * do_write_entry - reserves space for, writes and commits one entry
  *
- * The caller needs to hold log->mutex.
+ * Called with preemption disabled, so that no writer can be scheduled out
+ * between its reservation and its commit and stall the writers after it.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void do_write_entry(struct logger_log *log, struct logger_entry *header,
+			   const unsigned char *payload)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	size_t len = logger_entry_size(header->len);
+	struct timespec now;
+	size_t start;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	do {
+		start = ACCESS_ONCE(log->w_off);
+	} while (cmpxchg(&log->w_off, start, start + len) != start);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
-}
+	/* stamp the entry after reserving, so log order is time order */
+	now = current_kernel_time();
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
 
-/*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
- */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
-{
-	size_t len;
+	advance_head(log, start + len);
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	do_write_log(log, start + sizeof(u32), header,
+		     sizeof(struct logger_entry));
+	do_write_log(log, start + sizeof(u32) + sizeof(struct logger_entry),
+		     payload, header->len);
 
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+	/* wait for the writers that reserved before us to commit */
+	while (ACCESS_ONCE(log->c_off) != start)
+		cpu_relax();
+
+	do_write_log(log, start, &log->c_seq, sizeof(u32));
+	log->c_seq++;
 
-	log->w_off = logger_offset(log->w_off + count);
+	sec_logger_update_buffer(payload, header->len);
+	sec_logger_add_log_ram_console(log,
+				       logger_offset(start + sizeof(u32)));
 
+	smp_wmb();
+	ACCESS_ONCE(log->c_off) = start + len;
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * copy_iov_inatomic - gathers 'count' bytes of the iovec into 'buf'
+ * without sleeping. Returns 0 on success or -EFAULT if a page was not
+ * present.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int copy_iov_inatomic(unsigned char *buf, const struct iovec *iov,
+			     size_t count)
 {
-	size_t len;
+	int ret = 0;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	pagefault_disable();
+	while (count) {
+		size_t len = min_t(size_t, iov->iov_len, count);
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+		if (__copy_from_user_inatomic(buf, iov->iov_base, len)) {
+			ret = -EFAULT;
+			break;
+		}
+		buf += len;
+		count -= len;
+		iov++;
+	}
+	pagefault_enable();
 
-	sec_logger_update_buffer(log->buffer + log->w_off, count);
+	return ret;
+}
 
-	log->w_off = logger_offset(log->w_off + count);
+static int copy_iov(unsigned char *buf, const struct iovec *iov, size_t count)
+{
+	while (count) {
+		size_t len = min_t(size_t, iov->iov_len, count);
+
+		if (copy_from_user(buf, iov->iov_base, len))
+			return -EFAULT;
+		buf += len;
+		count -= len;
+		iov++;
+	}
 
-	return count;
+	return 0;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is gathered into this CPU's staging buffer with page faults
+ * disabled. Only if that faults do we fall back to a bounce buffer that
+ * may be filled while sleeping.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
-	struct timespec now;
-	ssize_t ret = 0;
-
-	now = current_kernel_time();
+	unsigned char *bounce = NULL;
+	unsigned char *payload;
 
 	header.pid = current->tgid;
 	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
 	header.euid = current_euid();
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 	header.hdr_size = sizeof(struct logger_entry);
@@ -442,47 +506,40 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	preempt_disable();
+	payload = __get_cpu_var(logger_stage);
+	if (unlikely(copy_iov_inatomic(payload, iov, header.len))) {
+		preempt_enable();
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		bounce = kmalloc(header.len, GFP_KERNEL);
+		if (!bounce)
+			return -ENOMEM;
+		if (copy_iov(bounce, iov, header.len)) {
+			kfree(bounce);
+			return -EFAULT;
 		}
+		payload = bounce;
 
-		iov++;
-		ret += nr;
+		preempt_disable();
 	}
 
-	sec_logger_add_log_ram_console(log, orig);
+	do_write_entry(log, &header, payload);
 
-	mutex_unlock(&log->mutex);
+	preempt_enable();
+	kfree(bounce);
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	/*
+	 * wake up any blocked readers; the barrier orders the lockless
+	 * commit of c_off before the queue check, pairing with the one
+	 * in prepare_to_wait()
+	 */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
 	sec_logger_print_buffer();
 
-	return ret;
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -512,15 +569,24 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->entry = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->entry) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		reader->r_ver = 1;
+		reader->r_batch = false;
+		reader->r_seq_valid = false;
+		reader->dropped = 0;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
 
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
+		reader->r_off = ACCESS_ONCE(log->head);
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -546,6 +612,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 		list_del(&reader->list);
 		mutex_unlock(&log->mutex);
 
+		kfree(reader->entry);
 		kfree(reader);
 	}
 
@@ -576,11 +643,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	if (!peek_entry(log, reader))
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -600,6 +663,31 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	return 0;
 }
 
+/*
+ * flush_log - drops every committed entry, for LOGGER_FLUSH_LOG
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void flush_log(struct logger_log *log)
+{
+	size_t c_off = ACCESS_ONCE(log->c_off);
+	struct logger_reader *reader;
+
+	list_for_each_entry(reader, &log->readers, list) {
+		reader->r_off = c_off;
+		reader->r_seq_valid = false;
+	}
+
+	/* head only ever moves forward, writers may have passed c_off */
+	for (;;) {
+		size_t head = ACCESS_ONCE(log->head);
+
+		if ((ssize_t)(c_off - head) <= 0 ||
+		    cmpxchg(&log->head, head, c_off) == head)
+			break;
+	}
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
@@ -619,10 +707,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		ret = min_t(size_t, ACCESS_ONCE(log->c_off) - reader->r_off,
+			    log->size);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -631,13 +717,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
+		if (!peek_entry(log, reader))
 			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+				reader->entry->len;
 		else
 			ret = 0;
 		break;
@@ -646,9 +728,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		flush_log(log);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -667,6 +747,23 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
+	case LOGGER_GET_DROPPED:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		ret = reader->dropped;
+		break;
+	case LOGGER_SET_BATCH:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->r_batch = !!arg;
+		ret = 0;
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -704,8 +801,11 @@ static struct logger_log VAR = { \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
 	.w_off = 0, \
+	.c_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.c_seq = 0, \
+	.dropped = ATOMIC_LONG_INIT(0), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 512*1024)
@@ -726,6 +826,17 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+static ssize_t logger_dropped_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct logger_log *log = container_of(misc, struct logger_log, misc);
+
+	return sprintf(buf, "%ld\n", atomic_long_read(&log->dropped));
+}
+
+static DEVICE_ATTR(dropped, S_IRUGO, logger_dropped_show, NULL);
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
@@ -737,6 +848,11 @@ static int __init init_log(struct logger_log *log)
 		return ret;
 	}
 
+	ret = device_create_file(log->misc.this_device, &dev_attr_dropped);
+	if (unlikely(ret))
+		printk(KERN_ERR "logger: failed to create drop counter "
+		       "for log '%s'\n", log->misc.name);
+
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
@@ -66,5 +66,7 @@ struct logger_entry {
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
 #define LOGGER_GET_VERSION		_IO(__LOGGERIO, 5) /* abi version */
 #define LOGGER_SET_VERSION		_IO(__LOGGERIO, 6) /* abi version */
+#define LOGGER_GET_DROPPED		_IO(__LOGGERIO, 7) /* lost entries */
+#define LOGGER_SET_BATCH		_IO(__LOGGERIO, 8) /* batch reads */
 
 #endif /* _LINUX_LOGGER_H */
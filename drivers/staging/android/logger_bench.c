@@ -0,0 +1,205 @@
+/*
+ * drivers/staging/android/logger_bench.c
+ *
+ * Write throughput benchmark for the Android logger
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Loading this module starts one writer thread per online CPU, each
+ * bound to its CPU, that write fixed-size entries to the log device
+ * 'path' for 'seconds' seconds. The total and per-CPU writes/sec are
+ * printed when all threads are done; unload and reload the module to run
+ * again. The entries look like ordinary log messages at VERBOSE priority
+ * with the tag "logger_bench".
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/jiffies.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+#include <linux/uaccess.h>
+
+static char *path = "/dev/log/main";
+module_param(path, charp, S_IRUGO);
+MODULE_PARM_DESC(path, "log device to write to");
+
+static unsigned int seconds = 5;
+module_param(seconds, uint, S_IRUGO);
+MODULE_PARM_DESC(seconds, "duration of the run");
+
+static unsigned int payload = 64;
+module_param(payload, uint, S_IRUGO);
+MODULE_PARM_DESC(payload, "bytes of payload per entry");
+
+#define LOGGER_BENCH_TAG	"logger_bench"
+
+struct logger_bench_thread {
+	struct task_struct *task;
+	unsigned long writes;
+	unsigned long errors;
+};
+
+static struct logger_bench_thread *logger_bench_threads;
+static struct file *logger_bench_file;
+static char *logger_bench_msg;
+static unsigned long logger_bench_end;
+static atomic_t logger_bench_running;
+static DECLARE_COMPLETION(logger_bench_done);
+
+static int logger_bench_fn(void *data)
+{
+	struct logger_bench_thread *t = data;
+	mm_segment_t old_fs = get_fs();
+
+	set_fs(KERNEL_DS);
+	while (time_before(jiffies, logger_bench_end)) {
+		loff_t pos = 0;
+
+		if (vfs_write(logger_bench_file, logger_bench_msg, payload,
+			      &pos) == payload)
+			t->writes++;
+		else
+			t->errors++;
+		cond_resched();
+	}
+	set_fs(old_fs);
+
+	if (atomic_dec_and_test(&logger_bench_running))
+		complete(&logger_bench_done);
+
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(HZ);
+
+	return 0;
+}
+
+static void logger_bench_report(void)
+{
+	unsigned long total = 0, errors = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		struct logger_bench_thread *t = &logger_bench_threads[cpu];
+
+		if (!t->task)
+			continue;
+		printk(KERN_INFO "logger_bench: cpu%d %lu writes/sec\n", cpu,
+		       t->writes / seconds);
+		total += t->writes;
+		errors += t->errors;
+	}
+
+	printk(KERN_INFO "logger_bench: %s %u byte entries on %d cpus: "
+	       "%lu writes/sec, %lu errors\n", path, payload,
+	       num_online_cpus(), total / seconds, errors);
+}
+
+static void logger_bench_stop(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct logger_bench_thread *t = &logger_bench_threads[cpu];
+
+		if (t->task)
+			kthread_stop(t->task);
+	}
+}
+
+static int __init logger_bench_init(void)
+{
+	int cpu, ret = 0;
+
+	if (!seconds || payload < sizeof(LOGGER_BENCH_TAG) + 2)
+		return -EINVAL;
+
+	logger_bench_msg = kmalloc(payload, GFP_KERNEL);
+	logger_bench_threads = kcalloc(nr_cpu_ids,
+				       sizeof(struct logger_bench_thread),
+				       GFP_KERNEL);
+	if (!logger_bench_msg || !logger_bench_threads) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	/* priority, tag and message, like liblog's __android_log_write() */
+	memset(logger_bench_msg, 'x', payload);
+	logger_bench_msg[0] = 2;
+	memcpy(logger_bench_msg + 1, LOGGER_BENCH_TAG,
+	       sizeof(LOGGER_BENCH_TAG));
+	logger_bench_msg[payload - 1] = '\0';
+
+	logger_bench_file = filp_open(path, O_WRONLY, 0);
+	if (IS_ERR(logger_bench_file)) {
+		ret = PTR_ERR(logger_bench_file);
+		printk(KERN_ERR "logger_bench: cannot open %s: %d\n", path,
+		       ret);
+		goto err_free;
+	}
+
+	get_online_cpus();
+	logger_bench_end = jiffies + seconds * HZ;
+	atomic_set(&logger_bench_running, 1);
+	for_each_online_cpu(cpu) {
+		struct logger_bench_thread *t = &logger_bench_threads[cpu];
+
+		t->task = kthread_create(logger_bench_fn, t,
+					 "logger_bench/%d", cpu);
+		if (IS_ERR(t->task)) {
+			ret = PTR_ERR(t->task);
+			t->task = NULL;
+			break;
+		}
+		kthread_bind(t->task, cpu);
+		atomic_inc(&logger_bench_running);
+		wake_up_process(t->task);
+	}
+	put_online_cpus();
+
+	if (!atomic_dec_and_test(&logger_bench_running))
+		wait_for_completion(&logger_bench_done);
+
+	if (!ret)
+		logger_bench_report();
+
+	logger_bench_stop();
+	filp_close(logger_bench_file, NULL);
+	if (ret)
+		goto err_free;
+
+	return 0;
+
+err_free:
+	kfree(logger_bench_threads);
+	kfree(logger_bench_msg);
+	return ret;
+}
+
+static void __exit logger_bench_exit(void)
+{
+	kfree(logger_bench_threads);
+	kfree(logger_bench_msg);
+}
+
+module_init(logger_bench_init);
+module_exit(logger_bench_exit);
+
+MODULE_DESCRIPTION("Android logger write benchmark");
+MODULE_LICENSE("GPL");
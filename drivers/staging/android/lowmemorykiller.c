@@ -12,6 +12,24 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * Candidates are found through the oom_adj index kept by the core (see
+ * CONFIG_OOM_ADJ_INDEX), walking buckets from the highest oom_adj down to the
+ * threshold and stopping at the first bucket that yields a victim, so a scan
+ * no longer visits every process in the system. The number of tasks examined,
+ * the number of kills and the time from SIGKILL to the victim being freed are
+ * exported as read-only parameters (scan_count, kill_count, kill_latency_ms
+ * and kill_latency_max_ms).
+ *
+ * Setting /sys/module/lowmemorykiller/parameters/pressure_mode switches the
+ * kill decision from the minfree table to reclaim pressure: over windows of
+ * pressure_window pages scanned by global reclaim, the share of scanned pages
+ * that could not be reclaimed and the number of page cache refaults per
+ * reclaimed page are combined into a 0-100 pressure value, which
+ * is matched against pressure_level to pick the oom_adj threshold from
+ * pressure_adj. The first minfree entry stays active as a backstop. The
+ * inputs and the last decision can be read from
+ * /sys/kernel/debug/lowmemorykiller/pressure.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -38,6 +56,11 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
 
 #ifdef CONFIG_ENHANCED_LMK_ROUTINE
 #define LOWMEM_DEATHPENDING_DEPTH 3
@@ -67,6 +90,47 @@ static struct task_struct *lowmem_deathpending[LOWMEM_DEATHPENDING_DEPTH] = {
 static struct task_struct *lowmem_deathpending;
 #endif
 static unsigned long lowmem_deathpending_timeout;
+#ifdef CONFIG_ENHANCED_LMK_ROUTINE
+static ktime_t lowmem_kill_time[LOWMEM_DEATHPENDING_DEPTH];
+#else
+static ktime_t lowmem_kill_time;
+#endif
+
+static unsigned long lowmem_scan_count;
+static unsigned long lowmem_kill_count;
+static unsigned int lowmem_kill_latency_ms;
+static unsigned int lowmem_kill_latency_max_ms;
+
+static bool lowmem_pressure_mode;
+static unsigned int lowmem_pressure_window = 16 * SWAP_CLUSTER_MAX;
+static int lowmem_pressure_level[6] = {
+	60,
+	80,
+	95,
+};
+static int lowmem_pressure_level_size = 3;
+static int lowmem_pressure_adj[6] = {
+	12,
+	6,
+	0,
+};
+static int lowmem_pressure_adj_size = 3;
+
+/*
+ * Counter snapshot taken at the start of the current pressure window and
+ * the result computed from the last complete one.
+ */
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static struct {
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long refaults;
+	unsigned long stamp;
+} lowmem_window;
+static unsigned int lowmem_reclaim_pressure;
+static unsigned int lowmem_refault_pressure;
+static unsigned int lowmem_pressure;
+static int lowmem_pressure_min_adj_last = OOM_ADJUST_MAX + 1;
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -81,6 +145,16 @@ static struct notifier_block task_nb = {
 	.notifier_call	= task_notify_func,
 };
 
+static void lowmem_record_latency(ktime_t kill_time)
+{
+	unsigned int ms;
+
+	ms = ktime_to_ms(ktime_sub(ktime_get(), kill_time));
+	lowmem_kill_latency_ms = ms;
+	if (ms > lowmem_kill_latency_max_ms)
+		lowmem_kill_latency_max_ms = ms;
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
@@ -90,17 +164,82 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 
 	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++)
 		if (task == lowmem_deathpending[i]) {
+			lowmem_record_latency(lowmem_kill_time[i]);
 			lowmem_deathpending[i] = NULL;
 			break;
 		}
 #else
-	if (task == lowmem_deathpending)
+	if (task == lowmem_deathpending) {
+		lowmem_record_latency(lowmem_kill_time);
 		lowmem_deathpending = NULL;
+	}
 #endif
 
 	return NOTIFY_OK;
 }
 
+static unsigned long lowmem_refaults(void)
+{
+	/* Evicted page cache that had to be read back in */
+	return global_page_state(WORKINGSET_REFAULT);
+}
+
+/*
+ * Fold the reclaim counters into a pressure value once a full window has
+ * been scanned, and translate the current pressure into an oom_adj
+ * threshold. A result older than a second is considered stale, since
+ * reclaim that stopped scanning is no longer under pressure.
+ */
+static int lowmem_pressure_min_adj(void)
+{
+	unsigned long scanned, reclaimed, refaults;
+	unsigned long d_scanned, d_reclaimed, d_refaults;
+	unsigned int pressure;
+	int array_size = ARRAY_SIZE(lowmem_pressure_level);
+	int min_adj = OOM_ADJUST_MAX + 1;
+	int i;
+
+	spin_lock(&lowmem_pressure_lock);
+	scanned = global_page_state(NR_VMSCAN_SCANNED);
+	reclaimed = global_page_state(NR_VMSCAN_RECLAIMED);
+	refaults = lowmem_refaults();
+	d_scanned = scanned - lowmem_window.scanned;
+	if (d_scanned >= lowmem_pressure_window) {
+		d_reclaimed = min(reclaimed - lowmem_window.reclaimed,
+				  d_scanned);
+		d_refaults = refaults - lowmem_window.refaults;
+
+		lowmem_reclaim_pressure =
+			100 - d_reclaimed * 100 / d_scanned;
+		lowmem_refault_pressure =
+			min(d_refaults * 100 / max(d_reclaimed, 1UL), 100UL);
+		lowmem_pressure = max(lowmem_reclaim_pressure,
+				      lowmem_refault_pressure);
+
+		lowmem_window.scanned = scanned;
+		lowmem_window.reclaimed = reclaimed;
+		lowmem_window.refaults = refaults;
+		lowmem_window.stamp = jiffies;
+	}
+	pressure = lowmem_pressure;
+	if (time_after(jiffies, lowmem_window.stamp + HZ))
+		pressure = 0;
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (lowmem_pressure_level_size < array_size)
+		array_size = lowmem_pressure_level_size;
+	if (lowmem_pressure_adj_size < array_size)
+		array_size = lowmem_pressure_adj_size;
+	for (i = array_size - 1; i >= 0; i--) {
+		if (pressure >= lowmem_pressure_level[i]) {
+			min_adj = lowmem_pressure_adj[i];
+			break;
+		}
+	}
+	lowmem_pressure_min_adj_last = min_adj;
+	return min_adj;
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *p;
@@ -113,6 +252,9 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
+	int adj;
+	unsigned long scanned = 0;
+	unsigned long flags;
 #ifdef CONFIG_ENHANCED_LMK_ROUTINE
 	int selected_tasksize[LOWMEM_DEATHPENDING_DEPTH] = {0,};
 	int selected_oom_adj[LOWMEM_DEATHPENDING_DEPTH] = {OOM_ADJUST_MAX,};
@@ -154,6 +296,8 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
+	if (lowmem_pressure_mode && array_size > 1)
+		array_size = 1;
 	for (i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
@@ -161,6 +305,8 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
+	if (lowmem_pressure_mode && sc->nr_to_scan > 0)
+		min_adj = min(min_adj, lowmem_pressure_min_adj());
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -182,95 +328,136 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	selected_oom_adj = min_adj;
 #endif
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	/*
+	 * Victims are chosen by highest oom_adj first, so walk the index from
+	 * the top and stop at the first bucket that filled the selection;
+	 * within a bucket the largest RSS still wins.
+	 *
+	 * The exit path takes oom_adj_index_lock under the sighand lock,
+	 * which in turn nests inside task_lock(). So a task whose
+	 * task_lock() is busy is skipped rather than waited for, and the
+	 * victims are pinned and only signalled once the lock is dropped,
+	 * as force_sig() takes the sighand lock.
+	 */
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj; adj--) {
+#ifdef CONFIG_ENHANCED_LMK_ROUTINE
+		if (all_selected_oom >= LOWMEM_DEATHPENDING_DEPTH)
+			break;
+#else
+		if (selected)
+			break;
+#endif
+		list_for_each_entry(p, oom_adj_index_bucket(adj), oom_adj_node) {
+			struct mm_struct *mm;
+			struct signal_struct *sig;
+			int oom_adj;
 
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+			if (!spin_trylock(&p->alloc_lock))
+				continue;
+			mm = p->mm;
+			sig = p->signal;
+			if (!mm || !sig) {
+				task_unlock(p);
+				continue;
+			}
+			scanned++;
+			oom_adj = sig->oom_adj;
+			if (oom_adj < min_adj) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
+			if (tasksize <= 0)
+				continue;
 
 #ifdef CONFIG_ENHANCED_LMK_ROUTINE
-		for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
-			if (all_selected_oom >= LOWMEM_DEATHPENDING_DEPTH) {
-				if (oom_adj < selected_oom_adj[i])
-					continue;
-				if (oom_adj == selected_oom_adj[i] &&
-					tasksize <= selected_tasksize[i])
+			for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
+				if (all_selected_oom >= LOWMEM_DEATHPENDING_DEPTH) {
+					if (oom_adj < selected_oom_adj[i])
+						continue;
+					if (oom_adj == selected_oom_adj[i] &&
+						tasksize <= selected_tasksize[i])
+						continue;
+				} else if (selected[i])
 					continue;
-			} else if (selected[i])
-				continue;
 
-			selected[i] = p;
-			selected_tasksize[i] = tasksize;
-			selected_oom_adj[i] = oom_adj;
+				selected[i] = p;
+				selected_tasksize[i] = tasksize;
+				selected_oom_adj[i] = oom_adj;
 
-			if (all_selected_oom < LOWMEM_DEATHPENDING_DEPTH)
-				all_selected_oom++;
-			lowmem_print(2, "select %d (%s), adj %d, size %d,"
-			     "to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+				if (all_selected_oom < LOWMEM_DEATHPENDING_DEPTH)
+					all_selected_oom++;
 
-			break;
-		}
+				break;
+			}
 #else
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-
+			if (selected) {
+				if (oom_adj < selected_oom_adj)
+					continue;
+				if (oom_adj == selected_oom_adj &&
+				    tasksize <= selected_tasksize)
+					continue;
+			}
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
 #endif
+		}
 	}
+	lowmem_scan_count += scanned;
+#ifdef CONFIG_ENHANCED_LMK_ROUTINE
+	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
+		if (selected[i])
+			get_task_struct(selected[i]);
+	}
+#else
+	if (selected)
+		get_task_struct(selected);
+#endif
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+
+	/* Report the selection only now that interrupts are back on */
 #ifdef CONFIG_ENHANCED_LMK_ROUTINE
 	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
 		if (selected[i]) {
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n",
+				     selected[i]->pid, selected[i]->comm,
+				     selected_oom_adj[i], selected_tasksize[i]);
 			lowmem_print(1, "send sigkill to %d (%s), adj %d,"
 				     "size %d\n",
 				     selected[i]->pid, selected[i]->comm,
 				     selected_oom_adj[i], selected_tasksize[i]);
 			lowmem_deathpending[i] = selected[i];
 			lowmem_deathpending_timeout = jiffies + HZ;
+			lowmem_kill_time[i] = ktime_get();
+			lowmem_kill_count++;
 			force_sig(SIGKILL, selected[i]);
+			put_task_struct(selected[i]);
 			rem -= selected_tasksize[i];
 		}
 	}
 #else
 	if (selected) {
+		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			     selected->pid, selected->comm,
+			     selected_oom_adj, selected_tasksize);
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_kill_time = ktime_get();
+		lowmem_kill_count++;
 		force_sig(SIGKILL, selected);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 #endif
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -279,15 +466,65 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_pressure_show(struct seq_file *m, void *unused)
+{
+	struct zone *zone;
+	unsigned long refaults = lowmem_refaults();
+
+	seq_printf(m, "mode: %s\n",
+		   lowmem_pressure_mode ? "pressure" : "minfree");
+	for_each_populated_zone(zone)
+		seq_printf(m, "node %d zone %-8s scanned %lu reclaimed %lu\n",
+			   zone_to_nid(zone), zone->name,
+			   zone_page_state(zone, NR_VMSCAN_SCANNED),
+			   zone_page_state(zone, NR_VMSCAN_RECLAIMED));
+
+	spin_lock(&lowmem_pressure_lock);
+	seq_printf(m, "refaults: %lu\n", refaults);
+	seq_printf(m, "window: scanned %lu reclaimed %lu refaults %lu "
+		   "age %ums\n",
+		   global_page_state(NR_VMSCAN_SCANNED) - lowmem_window.scanned,
+		   global_page_state(NR_VMSCAN_RECLAIMED) -
+		   lowmem_window.reclaimed,
+		   refaults - lowmem_window.refaults,
+		   jiffies_to_msecs(jiffies - lowmem_window.stamp));
+	seq_printf(m, "reclaim_pressure: %u\n", lowmem_reclaim_pressure);
+	seq_printf(m, "refault_pressure: %u\n", lowmem_refault_pressure);
+	seq_printf(m, "pressure: %u\n", lowmem_pressure);
+	spin_unlock(&lowmem_pressure_lock);
+	seq_printf(m, "min_adj: %d\n", lowmem_pressure_min_adj_last);
+	return 0;
+}
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_pressure_show, inode->i_private);
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *lowmem_debugfs_root;
+
 static int __init lowmem_init(void)
 {
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	lowmem_debugfs_root = debugfs_create_dir("lowmemorykiller", NULL);
+	if (lowmem_debugfs_root)
+		debugfs_create_file("pressure", S_IRUGO, lowmem_debugfs_root,
+				    NULL, &lowmem_pressure_fops);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	debugfs_remove_recursive(lowmem_debugfs_root);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 }
@@ -298,6 +535,19 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, bool,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_window, lowmem_pressure_window, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_array_named(pressure_level, lowmem_pressure_level, int,
+			 &lowmem_pressure_level_size, S_IRUGO | S_IWUSR);
+module_param_array_named(pressure_adj, lowmem_pressure_adj, int,
+			 &lowmem_pressure_adj_size, S_IRUGO | S_IWUSR);
+module_param_named(scan_count, lowmem_scan_count, ulong, S_IRUGO);
+module_param_named(kill_count, lowmem_kill_count, ulong, S_IRUGO);
+module_param_named(kill_latency_ms, lowmem_kill_latency_ms, uint, S_IRUGO);
+module_param_named(kill_latency_max_ms, lowmem_kill_latency_max_ms, uint,
+		   S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -28,10 +28,12 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/completion.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 #include "zram_drv.h"
 
@@ -89,21 +91,279 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/* Check whether the page is one word repeated, and return that word */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	if (!element) {
+		memset(ptr, 0, PAGE_SIZE);
+		return;
+	}
+
+	page = (unsigned long *)ptr;
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
+/*
+ * Deduplication: objects are looked up by a hash of their uncompressed
+ * contents, and a candidate is confirmed by decompressing and comparing
+ * it before it is shared.
+ */
+static u32 zram_dedup_checksum(struct page *page)
+{
+	void *mem;
+	u32 checksum;
+
+	mem = kmap_atomic(page, KM_USER0);
+	checksum = jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
+	kunmap_atomic(mem, KM_USER0);
+
+	return checksum;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *new)
+{
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	spin_lock(&zram->dedup_lock);
+	rb_node = &zram->dedup_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, node);
+		if (new->checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, rb_node);
+	rb_insert_color(&new->node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+}
+
+/*
+ * Drop a reference to an entry, freeing its object with the last one.
+ * Returns true if the object was freed.
+ */
+static bool zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return false;
+	}
+	rb_erase(&entry->node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->len);
+	kfree(entry);
+	return true;
+}
+
+static bool zram_dedup_match(struct zram *zram, struct zram_stream *strm,
+				struct zram_entry *entry, struct page *page)
+{
+	int ret;
+	void *cmem, *mem;
+	unsigned int clen = PAGE_SIZE;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	ret = crypto_comp_decompress(strm->tfm, cmem, entry->len,
+					strm->buffer, &clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	if (ret || clen != PAGE_SIZE)
+		return false;
+
+	mem = kmap_atomic(page, KM_USER0);
+	ret = memcmp(mem, strm->buffer, PAGE_SIZE);
+	kunmap_atomic(mem, KM_USER0);
+
+	return !ret;
+}
+
+/*
+ * Find a stored object with the same contents as @page and return it
+ * with a reference held, or NULL. Only the first entry with a matching
+ * checksum is tried; collisions are rare enough not to walk them all.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+			struct zram_stream *strm, struct page *page,
+			u32 checksum)
+{
+	struct rb_node *rb_node;
+	struct zram_entry *entry = NULL;
+
+	spin_lock(&zram->dedup_lock);
+	rb_node = zram->dedup_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, node);
+		if (checksum == entry->checksum)
+			break;
+		if (checksum < entry->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+	}
+	if (!rb_node) {
+		spin_unlock(&zram->dedup_lock);
+		return NULL;
+	}
+	entry->refcount++;
+	spin_unlock(&zram->dedup_lock);
+
+	if (zram_dedup_match(zram, strm, entry, page))
+		return entry;
+
+	zram_dedup_put(zram, entry);
+	return NULL;
+}
+
+static void zram_stream_free(struct zram_stream *strm)
+{
+	if (!IS_ERR_OR_NULL(strm->tfm))
+		crypto_free_comp(strm->tfm);
+	free_pages((unsigned long)strm->buffer, 1);
+	kfree(strm);
+}
+
+static struct zram_stream *zram_stream_alloc(struct zram *zram, gfp_t flags)
+{
+	struct zram_stream *strm;
+
+	strm = kzalloc(sizeof(*strm), flags);
+	if (!strm)
+		return NULL;
+
+	strm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+	/*
+	 * Incompressible data can expand beyond PAGE_SIZE, so give the
+	 * compressor room for two pages.
+	 */
+	strm->buffer = (void *)__get_free_pages(flags | __GFP_ZERO, 1);
+	if (IS_ERR(strm->tfm) || !strm->buffer) {
+		zram_stream_free(strm);
+		return NULL;
+	}
+	return strm;
+}
+
+/*
+ * Get an idle compression stream, or wait for one to be released. The
+ * streams are allocated up front by zram_init_device() and
+ * zram_set_max_streams(): allocating a transform may recurse into
+ * reclaim and I/O whatever gfp flags are asked for, which the I/O path
+ * must not do. There is always at least one stream once the device is
+ * initialised, so this cannot fail.
+ */
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *strm;
+
+	while (1) {
+		spin_lock(&zram->strm_lock);
+		if (!list_empty(&zram->idle_strm)) {
+			strm = list_first_entry(&zram->idle_strm,
+						struct zram_stream, list);
+			list_del(&strm->list);
+			spin_unlock(&zram->strm_lock);
+			return strm;
+		}
+		spin_unlock(&zram->strm_lock);
+
+		wait_event(zram->strm_wait, !list_empty(&zram->idle_strm));
+	}
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *strm)
+{
+	spin_lock(&zram->strm_lock);
+	if (zram->avail_strm <= zram->max_strm) {
+		list_add(&strm->list, &zram->idle_strm);
+		spin_unlock(&zram->strm_lock);
+		wake_up(&zram->strm_wait);
+		return;
+	}
+
+	/* max_comp_streams was lowered while this one was busy */
+	zram->avail_strm--;
+	spin_unlock(&zram->strm_lock);
+	zram_stream_free(strm);
+}
+
+/*
+ * Allocate streams until max_strm exist. Called with init_lock held.
+ * Returns 0, or -ENOMEM if not all of them could be allocated.
+ */
+static int zram_stream_fill(struct zram *zram)
+{
+	struct zram_stream *strm;
+
+	while (1) {
+		spin_lock(&zram->strm_lock);
+		if (zram->avail_strm >= zram->max_strm) {
+			spin_unlock(&zram->strm_lock);
+			return 0;
+		}
+		spin_unlock(&zram->strm_lock);
+
+		strm = zram_stream_alloc(zram, GFP_KERNEL);
+		if (!strm)
+			return -ENOMEM;
+
+		spin_lock(&zram->strm_lock);
+		list_add(&strm->list, &zram->idle_strm);
+		zram->avail_strm++;
+		spin_unlock(&zram->strm_lock);
+		wake_up(&zram->strm_wait);
+	}
+}
+
+int zram_set_max_streams(struct zram *zram, int num_strm)
+{
+	struct zram_stream *strm, *tmp;
+	LIST_HEAD(release);
+	int ret = 0;
+
+	mutex_lock(&zram->init_lock);
+	spin_lock(&zram->strm_lock);
+	zram->max_strm = num_strm;
+	while (zram->avail_strm > num_strm &&
+	       !list_empty(&zram->idle_strm)) {
+		list_move(zram->idle_strm.next, &release);
+		zram->avail_strm--;
+	}
+	spin_unlock(&zram->strm_lock);
+
+	if (zram->init_done)
+		ret = zram_stream_fill(zram);
+	mutex_unlock(&zram->init_lock);
+
+	list_for_each_entry_safe(strm, tmp, &release, list)
+		zram_stream_free(strm);
+
+	return ret;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,56 +393,126 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static u32 zram_now(void)
+{
+	return div_u64(get_jiffies_64(), HZ);
+}
+
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = zram_now();
+}
+
+/*
+ * Allocate @count contiguous blocks on the backing device, returning the
+ * first one or -ENOSPC.
+ */
+static long zram_bd_alloc(struct zram *zram, unsigned int count)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bd_lock);
+	blk = bitmap_find_next_zero_area(zram->bd_bitmap, zram->bd_nr_pages,
+					0, count, 0);
+	if (blk >= zram->bd_nr_pages) {
+		spin_unlock(&zram->bd_lock);
+		return -ENOSPC;
+	}
+	bitmap_set(zram->bd_bitmap, blk, count);
+	spin_unlock(&zram->bd_lock);
+
+	return blk;
+}
+
+static void zram_bd_free(struct zram *zram, unsigned long blk,
+			unsigned int count)
+{
+	spin_lock(&zram->bd_lock);
+	bitmap_clear(zram->bd_bitmap, blk, count);
+	spin_unlock(&zram->bd_lock);
+}
+#else
+static void zram_accessed(struct zram *zram, u32 index)
+{
+}
+#endif
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	/* Tell a writeback in progress that this slot has changed */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_bd_free(zram, zram->table[index].bdev_index, 1);
+		zram_stat64_sub(zram, &zram->stats.bd_count, 1);
+		zram->table[index].bdev_index = 0;
+		return;
+	}
+#endif
+
+	/*
+	 * No memory is allocated for same element filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		if (!zram->table[index].element)
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].element = 0;
 		return;
 	}
 
+	if (unlikely(!handle))
+		return;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = zram->table[index].size;
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		if (!zram_dedup_put(zram, zram->table[index].entry)) {
+			zram_stat64_sub(zram, &zram->stats.dup_data_size,
+					clen);
+			zram_stat_dec(&zram->stats.pages_dup);
+		}
+		zram_stat_dec(&zram->stats.pages_stored);
+		goto clear;
+	}
+
+	zs_free(zram->mem_pool, handle);
+
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+clear:
+
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
 	void *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	zram_fill_page(user_mem, element);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -194,73 +524,492 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
 
+/*
+ * Reads of written back pages are chained to the zram bio, which
+ * completes when the last of them does. They cannot be waited for: bios
+ * submitted from a make_request function are only issued after it
+ * returns.
+ */
+struct zram_bd_read {
+	struct bio *parent;
+	atomic_t pending;
+	int error;
+};
+
+static void zram_bd_read_put(struct zram_bd_read *rd)
+{
+	if (!atomic_dec_and_test(&rd->pending))
+		return;
+
+	if (rd->error) {
+		bio_io_error(rd->parent);
+	} else {
+		set_bit(BIO_UPTODATE, &rd->parent->bi_flags);
+		bio_endio(rd->parent, 0);
+	}
+	kfree(rd);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Pages written back by one bio, at most */
+#define ZRAM_WB_BATCH	32
+
+static void zram_bd_read_end_io(struct bio *bio, int err)
+{
+	struct zram_bd_read *rd = bio->bi_private;
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		rd->error = -EIO;
+	else
+		flush_dcache_page(bio->bi_io_vec[0].bv_page);
+	bio_put(bio);
+	zram_bd_read_put(rd);
+}
+
+static int zram_bd_read(struct zram *zram, struct zram_bd_read **rdp,
+			struct bio *parent, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bd_read *rd = *rdp;
+	struct bio *bio;
+
+	if (!rd) {
+		rd = kmalloc(sizeof(*rd), GFP_NOIO);
+		if (!rd)
+			return -ENOMEM;
+		rd->parent = parent;
+		atomic_set(&rd->pending, 1);
+		rd->error = 0;
+		*rdp = rd;
+	}
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->backing_dev;
+	bio->bi_sector = blk << (PAGE_SHIFT - SECTOR_SHIFT);
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		bio_put(bio);
+		return -EIO;
+	}
+	bio->bi_end_io = zram_bd_read_end_io;
+	bio->bi_private = rd;
+
+	atomic_inc(&rd->pending);
+	submit_bio(READ, bio);
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+
+	return 0;
+}
+
+static void zram_bd_end_io_sync(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Write up to @count pages to consecutive blocks starting at @blk and
+ * wait for completion. Returns the number of pages written, which is
+ * less than @count if the queue limits did not allow a larger bio.
+ */
+static int zram_bd_write(struct zram *zram, struct page **pages,
+			unsigned int count, unsigned long blk)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	unsigned int i;
+	int ret;
+
+	bio = bio_alloc(GFP_KERNEL, count);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->backing_dev;
+	bio->bi_sector = blk << (PAGE_SHIFT - SECTOR_SHIFT);
+	for (i = 0; i < count; i++) {
+		if (bio_add_page(bio, pages[i], PAGE_SIZE, 0) != PAGE_SIZE)
+			break;
+	}
+	if (!i) {
+		bio_put(bio);
+		return -EIO;
+	}
+	bio->bi_end_io = zram_bd_end_io_sync;
+	bio->bi_private = &done;
+
+	submit_bio(WRITE, bio);
+	wait_for_completion(&done);
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? i : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+/*
+ * Copy the contents of a slot due for writeback into @page and mark it
+ * ZRAM_UNDER_WB. Returns false if the slot does not qualify. Shared
+ * objects are left alone, writing them back would not free them.
+ */
+static bool zram_wb_pick(struct zram *zram, struct zram_stream *strm,
+			u32 index, enum zram_wb_mode mode, u32 now,
+			struct page *page)
+{
+	bool incompressible, idle, shared = false;
+	unsigned long handle;
+	unsigned char *mem, *cmem;
+	unsigned int clen = PAGE_SIZE;
+	int ret = 0;
+
+	write_lock(&zram->tb_lock);
+	if (zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+	    !zram->table[index].handle)
+		goto skip;
+
+	/*
+	 * Writing back a deduplicated object still referenced by other
+	 * slots frees no memory, so only pick ones this slot owns alone.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		spin_lock(&zram->dedup_lock);
+		shared = zram->table[index].entry->refcount > 1;
+		spin_unlock(&zram->dedup_lock);
+	}
+	if (shared)
+		goto skip;
+
+	incompressible = zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+	idle = now - zram->table[index].ac_time >= zram->wb_idle_secs;
+	if ((mode == ZRAM_WB_INCOMPRESSIBLE && !incompressible) ||
+	    (mode == ZRAM_WB_IDLE && !idle) ||
+	    (mode == ZRAM_WB_ALL && !incompressible && !idle))
+		goto skip;
+
+	mem = kmap_atomic(page, KM_USER0);
+	if (incompressible) {
+		cmem = kmap_atomic(zram->table[index].page, KM_USER1);
+		memcpy(mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+	} else {
+		handle = zram->table[index].handle;
+		if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			handle = zram->table[index].entry->handle;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+		ret = crypto_comp_decompress(strm->tfm, cmem,
+				zram->table[index].size, mem, &clen);
+		zs_unmap_object(zram->mem_pool, handle);
+	}
+	kunmap_atomic(mem, KM_USER0);
+	if (ret || clen != PAGE_SIZE)
+		goto skip;
+
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	write_unlock(&zram->tb_lock);
+	return true;
+
+skip:
+	write_unlock(&zram->tb_lock);
+	return false;
+}
+
+/*
+ * Write a batch out in as few bios as the free space allows, then
+ * switch the slots which did not change meanwhile over to their blocks.
+ */
+static int zram_wb_flush(struct zram *zram, struct page **pages, u32 *idx,
+			unsigned int count)
+{
+	unsigned int done = 0, i;
+	int n, ret = 0;
+	long blk;
+
+	while (done < count) {
+		/* Take the longest run of free blocks we can get */
+		n = count - done;
+		while ((blk = zram_bd_alloc(zram, n)) < 0 && n > 1)
+			n /= 2;
+		if (blk < 0) {
+			ret = blk;
+			break;
+		}
+
+		ret = zram_bd_write(zram, pages + done, n, blk);
+		if (ret < 0) {
+			zram_bd_free(zram, blk, n);
+			break;
+		}
+		if (ret < n)
+			zram_bd_free(zram, blk + ret, n - ret);
+		n = ret;
+		ret = 0;
+
+		write_lock(&zram->tb_lock);
+		for (i = 0; i < n; i++) {
+			u32 index = idx[done + i];
+
+			/* Rewritten or freed while the write was in flight */
+			if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+				zram_bd_free(zram, blk + i, 1);
+				continue;
+			}
+			zram_free_page(zram, index);
+			zram->table[index].bdev_index = blk + i;
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_stat64_inc(zram, &zram->stats.bd_count);
+		}
+		write_unlock(&zram->tb_lock);
+		zram_stat64_add(zram, &zram->stats.bd_writes, n);
+		done += n;
+	}
+
+	if (done < count) {
+		write_lock(&zram->tb_lock);
+		for (i = done; i < count; i++)
+			zram_clear_flag(zram, idx[i], ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+	}
+
+	return ret;
+}
+
+/*
+ * Move pages selected by @mode to the backing device, ZRAM_WB_BATCH at
+ * a time. Called with init_lock held on an initialized device.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	struct page *pages[ZRAM_WB_BATCH] = { NULL };
+	u32 idx[ZRAM_WB_BATCH];
+	u32 index, now = zram_now();
+	unsigned int i, count = 0;
+	struct zram_stream *strm;
+	int ret = 0;
+
+	if (!zram->backing_dev)
+		return -ENODEV;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		strm = zram_stream_get(zram);
+		if (zram_wb_pick(zram, strm, index, mode, now, pages[count]))
+			idx[count++] = index;
+		zram_stream_put(zram, strm);
+
+		if (count == ZRAM_WB_BATCH) {
+			ret = zram_wb_flush(zram, pages, idx, count);
+			count = 0;
+			if (ret)
+				break;
+		}
+		cond_resched();
+	}
+	if (count)
+		ret = zram_wb_flush(zram, pages, idx, count);
+
+out:
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		if (pages[i])
+			__free_page(pages[i]);
+	}
+	return ret;
+}
+
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->backing_dev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bd_bitmap);
+	kfree(zram->backing_dev_path);
+	zram->backing_dev = NULL;
+	zram->bd_bitmap = NULL;
+	zram->backing_dev_path = NULL;
+	zram->bd_nr_pages = 0;
+}
+
+/* Called with init_lock held on an uninitialized device */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_pages, *bitmap = NULL;
+	char *p;
+	int ret;
+
+	p = kstrdup(path, GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+
+	bdev = blkdev_get_by_path(p, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto fail;
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto fail_put;
+
+	ret = -EINVAL;
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (!nr_pages)
+		goto fail_put;
+
+	ret = -ENOMEM;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap)
+		goto fail_put;
+
+	zram_reset_backing_dev(zram);
+	zram->backing_dev = bdev;
+	zram->backing_dev_path = p;
+	zram->bd_bitmap = bitmap;
+	zram->bd_nr_pages = nr_pages;
+
+	pr_info("%s: using %s as backing device, %lu pages\n",
+		zram->disk->disk_name, p, nr_pages);
+	return 0;
+
+fail_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+fail:
+	kfree(p);
+	return ret;
+}
+#endif
+
 static void zram_read(struct zram *zram, struct bio *bio)
 {
 
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_bd_read *rd = NULL;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
+		unsigned int clen;
+		u64 start;
+		unsigned long handle;
 		struct page *page;
-		struct zobj_header *zheader;
+		struct zram_stream *strm = NULL;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
+again:
+		read_lock(&zram->tb_lock);
+		if (zram_test_flag(zram, index, ZRAM_SAME)) {
+			unsigned long element = zram->table[index].element;
+
+			read_unlock(&zram->tb_lock);
+			if (strm)
+				zram_stream_put(zram, strm);
+			handle_same_page(page, element);
+			index++;
+			continue;
+		}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+		if (zram_test_flag(zram, index, ZRAM_WB)) {
+			unsigned long blk = zram->table[index].bdev_index;
+
+			zram_accessed(zram, index);
+			read_unlock(&zram->tb_lock);
+			if (strm)
+				zram_stream_put(zram, strm);
+			if (zram_bd_read(zram, &rd, bio, page, blk)) {
+				zram_stat64_inc(zram,
+					&zram->stats.failed_reads);
+				goto out;
+			}
 			index++;
 			continue;
 		}
+#endif
 
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		if (unlikely(!zram->table[index].handle)) {
+			read_unlock(&zram->tb_lock);
+			if (strm)
+				zram_stream_put(zram, strm);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
+			handle_same_page(page, 0);
 			index++;
 			continue;
 		}
 
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+			zram_accessed(zram, index);
 			handle_uncompressed_page(zram, page, index);
+			read_unlock(&zram->tb_lock);
+			if (strm)
+				zram_stream_put(zram, strm);
 			index++;
 			continue;
 		}
 
+		/*
+		 * Transforms may keep decompression state, so each reader
+		 * needs a stream of its own. Getting one may sleep, so drop
+		 * the table lock and look at the slot again afterwards.
+		 */
+		if (!strm) {
+			read_unlock(&zram->tb_lock);
+			strm = zram_stream_get(zram);
+			goto again;
+		}
+
+		zram_accessed(zram, index);
+
+		handle = zram->table[index].handle;
+		if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			handle = zram->table[index].entry->handle;
+
 		user_mem = kmap_atomic(page, KM_USER0);
 		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		start = local_clock();
+		ret = crypto_comp_decompress(strm->tfm, cmem,
+			zram->table[index].size, user_mem, &clen);
+		start = local_clock() - start;
 
+		zs_unmap_object(zram->mem_pool, handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		read_unlock(&zram->tb_lock);
+		zram_stream_put(zram, strm);
+
+		zram_stat64_inc(zram, &zram->stats.pages_decompressed);
+		zram_stat64_add(zram, &zram->stats.decomp_time, start);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret || clen != PAGE_SIZE)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -271,11 +1020,22 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		index++;
 	}
 
+	/* With backing device reads in flight, the last one ends the bio */
+	if (rd) {
+		zram_bd_read_put(rd);
+		return;
+	}
+
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
 
 out:
+	if (rd) {
+		rd->error = -EIO;
+		zram_bd_read_put(rd);
+		return;
+	}
 	bio_io_error(bio);
 }
 
@@ -290,42 +1050,79 @@ static void zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
+		unsigned int clen;
+		u64 start;
+		unsigned long handle, element;
+		u32 checksum = 0;
+		struct zram_entry *entry = NULL;
+		struct zram_stream *strm;
 		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
+		if (page_same_filled(user_mem, &element)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
+			write_lock(&zram->tb_lock);
+			/*
+			 * System overwrites unused sectors. Free memory
+			 * associated with this sector now.
+			 */
+			zram_free_page(zram, index);
+			if (!element)
+				zram_stat_inc(&zram->stats.pages_zero);
+			zram_stat_inc(&zram->stats.pages_same);
+			zram->table[index].element = element;
+			zram_set_flag(zram, index, ZRAM_SAME);
+			write_unlock(&zram->tb_lock);
 			index++;
 			continue;
 		}
+		kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		/* may sleep until another writer releases its stream */
+		strm = zram_stream_get(zram);
+
+		if (zram->dedup_enable) {
+			checksum = zram_dedup_checksum(page);
+			entry = zram_dedup_find(zram, strm, page, checksum);
+			if (entry) {
+				zram_stream_put(zram, strm);
+
+				write_lock(&zram->tb_lock);
+				zram_free_page(zram, index);
+				zram->table[index].entry = entry;
+				zram->table[index].size = entry->len;
+				zram_set_flag(zram, index, ZRAM_DEDUP);
+				zram_accessed(zram, index);
+				zram_stat_inc(&zram->stats.pages_stored);
+				zram_stat_inc(&zram->stats.pages_dup);
+				if (entry->len <= PAGE_SIZE / 2)
+					zram_stat_inc(
+						&zram->stats.good_compress);
+				write_unlock(&zram->tb_lock);
+				zram_stat64_add(zram,
+					&zram->stats.dup_data_size,
+					entry->len);
+				index++;
+				continue;
+			}
+		}
 
+		user_mem = kmap_atomic(page, KM_USER0);
+		clen = 2 * PAGE_SIZE;
+		start = local_clock();
+		ret = crypto_comp_compress(strm->tfm, user_mem, PAGE_SIZE,
+					   strm->buffer, &clen);
+		start = local_clock() - start;
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		zram_stat64_inc(zram, &zram->stats.pages_compressed);
+		zram_stat64_add(zram, &zram->stats.comp_time, start);
+
+		if (unlikely(ret)) {
+			zram_stream_put(zram, strm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -337,10 +1134,9 @@ static void zram_write(struct zram *zram, struct bio *bio)
 		 * errors which has side effect of hanging the system.
 		 */
 		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
+			zram_stream_put(zram, strm);
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -348,52 +1144,72 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				goto out;
 			}
 
-			offset = 0;
+			user_mem = kmap_atomic(page, KM_USER0);
+			cmem = kmap_atomic(page_store, KM_USER1);
+			memcpy(cmem, user_mem, PAGE_SIZE);
+			kunmap_atomic(cmem, KM_USER1);
+			kunmap_atomic(user_mem, KM_USER0);
+
+			write_lock(&zram->tb_lock);
+			zram_free_page(zram, index);
+			zram->table[index].page = page_store;
 			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+			zram_accessed(zram, index);
 			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+			zram_stat_inc(&zram->stats.pages_stored);
+			write_unlock(&zram->tb_lock);
+			zram_stat64_add(zram, &zram->stats.compr_size,
+					PAGE_SIZE);
+			index++;
+			continue;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		handle = zs_malloc(zram->mem_pool, clen);
+		if (!handle) {
+			zram_stream_put(zram, strm);
 			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
+				"page: %u, size=%u\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
-
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+		memcpy(cmem, strm->buffer, clen);
+		zs_unmap_object(zram->mem_pool, handle);
+		zram_stream_put(zram, strm);
+
+		/* Without an entry the object is simply not shared */
+		if (zram->dedup_enable)
+			entry = kmalloc(sizeof(*entry), GFP_NOIO);
+		if (entry) {
+			entry->handle = handle;
+			entry->checksum = checksum;
+			entry->len = clen;
+			entry->refcount = 1;
+			zram_dedup_insert(zram, entry);
 		}
-#endif
-
-		memcpy(cmem, src, clen);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
-
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+		/*
+		 * Replace whatever the sector held before and update the
+		 * stats in one go so readers see either the old or the new
+		 * object.
+		 */
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
+		if (entry) {
+			zram->table[index].entry = entry;
+			zram_set_flag(zram, index, ZRAM_DEDUP);
+		} else {
+			zram->table[index].handle = handle;
+		}
+		zram->table[index].size = clen;
+		zram_accessed(zram, index);
 		zram_stat_inc(&zram->stats.pages_stored);
 		if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
+		write_unlock(&zram->tb_lock);
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
 
-		mutex_unlock(&zram->lock);
 		index++;
 	}
 
@@ -457,39 +1273,33 @@ void zram_reset_device(struct zram *zram)
 {
 	size_t index;
 
+	struct zram_stream *strm, *tmp;
+
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free the compression streams, none can be busy by now */
+	list_for_each_entry_safe(strm, tmp, &zram->idle_strm, list) {
+		list_del(&strm->list);
+		zram_stream_free(strm);
+	}
+	zram->avail_strm = 0;
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
-	}
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_backing_dev(zram);
+#endif
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -501,6 +1311,7 @@ int zram_init_device(struct zram *zram)
 {
 	int ret;
 	size_t num_pages;
+	struct zram_stream *strm;
 
 	mutex_lock(&zram->init_lock);
 
@@ -511,19 +1322,21 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	/*
+	 * All streams are allocated here, as the I/O path must not. Only
+	 * the first one is required for I/O to make progress.
+	 */
+	strm = zram_stream_alloc(zram, GFP_KERNEL);
+	if (!strm) {
+		pr_err("Error allocating compression stream\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
+	list_add(&strm->list, &zram->idle_strm);
+	zram->avail_strm = 1;
+	if (zram_stream_fill(zram))
+		pr_warning("Allocated only %d of %d compression streams\n",
+			zram->avail_strm, zram->max_strm);
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -540,7 +1353,8 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1380,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1395,21 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->tb_lock);
+	spin_lock_init(&zram->strm_lock);
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_root = RB_ROOT;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bd_lock);
+	zram->wb_idle_secs = 3600;
+#endif
+	INIT_LIST_HEAD(&zram->idle_strm);
+	init_waitqueue_head(&zram->strm_wait);
+	zram->max_strm = num_online_cpus();
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/wait.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,23 +30,14 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compressor, any crypto API "compression" algorithm can be used */
+static const char default_compressor[] = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -50,9 +45,10 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than or equal to ZS_MAX_ALLOC_SIZE,
+ * otherwise, zs_malloc() would always return failure. Above 3/4 of a
+ * page a size class packs no better than a page of its own, so such
+ * pages are kept as they are and need no decompression.
  */
 
 /*-- End of configurable params */
@@ -68,20 +64,50 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is filled with one repeated word, kept in table.element */
+	ZRAM_SAME,
+
+	/* Object is shared with other pages through table.entry */
+	ZRAM_DEDUP,
+
+	/* Page was written to the backing device at table.bdev_index */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if the slot changes */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * With deduplication enabled, each compressed object is owned by an
+ * entry which every table slot holding the same contents points to.
+ */
+struct zram_entry {
+	struct rb_node node;	/* in zram->dedup_root, keyed by checksum */
+	unsigned long handle;
+	u32 checksum;		/* of the uncompressed page */
+	u16 len;		/* compressed length */
+	int refcount;		/* protected by zram->dedup_lock */
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		unsigned long handle;	/* zsmalloc object */
+		struct page *page;	/* ZRAM_UNCOMPRESSED */
+		struct zram_entry *entry; /* ZRAM_DEDUP */
+		unsigned long element;	/* ZRAM_SAME */
+		unsigned long bdev_index; /* ZRAM_WB */
+	};
+	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, in seconds since boot */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -92,20 +118,58 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 pages_compressed;	/* no. of compressor invocations */
+	u64 pages_decompressed;	/* no. of decompressor invocations */
+	u64 comp_time;		/* total ns spent compressing */
+	u64 decomp_time;	/* total ns spent decompressing */
+	u64 dup_data_size;	/* compressed bytes shared, not stored again */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of same element filled pages */
+	u32 pages_dup;		/* no. of pages sharing a stored object */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u64 bd_count;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of pages read from it */
+	u64 bd_writes;		/* no. of pages written to it */
+#endif
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
+/*
+ * Compressor transform and output buffer for one page in flight. Readers
+ * and writers take an idle stream for the duration of a page, so up to
+ * max_strm pages are (de)compressed concurrently.
+ */
+struct zram_stream {
+	struct crypto_comp *tfm;
+	void *buffer;
+	struct list_head list;
+};
+
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t tb_lock;	/* protect table entries and 32-bit stats;
+				 * read for lookups, write for updates */
+	spinlock_t strm_lock;	/* protect the stream fields below */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* streams allocated, idle or busy */
+	int max_strm;		/* limit set through max_comp_streams */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	bool dedup_enable;
+	spinlock_t dedup_lock;	/* protect dedup_root and entry refcounts */
+	struct rb_root dedup_root;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct block_device *backing_dev;
+	char *backing_dev_path;
+	unsigned long *bd_bitmap;	/* blocks in use on backing_dev */
+	unsigned long bd_nr_pages;
+	spinlock_t bd_lock;		/* protect bd_bitmap */
+	unsigned int wb_idle_secs;	/* age of pages "idle" writes back */
+#endif
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -128,5 +192,18 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_max_streams(struct zram *zram, int num_strm);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* What zram_writeback() writes to the backing device */
+enum zram_wb_mode {
+	ZRAM_WB_INCOMPRESSIBLE,	/* pages stored uncompressed */
+	ZRAM_WB_IDLE,		/* pages not accessed for wb_idle_secs */
+	ZRAM_WB_ALL,		/* either of the above */
+};
+
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+#endif
 
 #endif
@@ -15,6 +15,9 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/mm.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/string.h>
 
 #include "zram_drv.h"
 
@@ -112,6 +115,97 @@ static ssize_t reset_store(struct device *dev,
 	return len;
 }
 
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->max_strm);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long num;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &num);
+	if (ret)
+		return ret;
+
+	if (num < 1 || num > INT_MAX)
+		return -EINVAL;
+
+	ret = zram_set_max_streams(zram, num);
+	if (ret)
+		return ret;
+
+	return len;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%s\n", zram->compressor);
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char name[CRYPTO_MAX_ALG_NAME];
+	struct zram *zram = dev_to_zram(dev);
+
+	strlcpy(name, buf, sizeof(name));
+	strim(name);
+	if (!crypto_has_comp(name, 0, 0))
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change compressor for initialized device\n");
+		return -EBUSY;
+	}
+	strlcpy(zram->compressor, name, sizeof(zram->compressor));
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t dedup_enable_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->dedup_enable);
+}
+
+static ssize_t dedup_enable_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change dedup for initialized device\n");
+		return -EBUSY;
+	}
+	zram->dedup_enable = !!val;
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
 static ssize_t num_reads_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -156,6 +250,31 @@ static ssize_t zero_pages_show(struct device *dev,
 	return sprintf(buf, "%u\n", zram->stats.pages_zero);
 }
 
+static ssize_t same_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_same);
+}
+
+static ssize_t dup_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_dup);
+}
+
+static ssize_t dup_data_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dup_data_size));
+}
+
 static ssize_t orig_data_size_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -174,6 +293,45 @@ static ssize_t compr_data_size_show(struct device *dev,
 		zram_stat64_read(zram, &zram->stats.compr_size));
 }
 
+/* orig_data_size / compr_data_size, with two decimals */
+static ssize_t compr_ratio_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 orig, compr, ratio = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	orig = (u64)(zram->stats.pages_stored) << PAGE_SHIFT;
+	compr = zram_stat64_read(zram, &zram->stats.compr_size);
+	if (compr)
+		ratio = div64_u64(orig * 100, compr);
+
+	return sprintf(buf, "%llu.%02llu\n", ratio / 100, ratio % 100);
+}
+
+static ssize_t avg_comp_time_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 nr, time;
+	struct zram *zram = dev_to_zram(dev);
+
+	nr = zram_stat64_read(zram, &zram->stats.pages_compressed);
+	time = zram_stat64_read(zram, &zram->stats.comp_time);
+
+	return sprintf(buf, "%llu\n", nr ? div64_u64(time, nr) : 0);
+}
+
+static ssize_t avg_decomp_time_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 nr, time;
+	struct zram *zram = dev_to_zram(dev);
+
+	nr = zram_stat64_read(zram, &zram->stats.pages_decompressed);
+	time = zram_stat64_read(zram, &zram->stats.decomp_time);
+
+	return sprintf(buf, "%llu\n", nr ? div64_u64(time, nr) : 0);
+}
+
 static ssize_t mem_used_total_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -181,38 +339,235 @@ static ssize_t mem_used_total_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
+		val = zs_get_total_size_bytes(zram->mem_pool) +
 			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
 	}
 
 	return sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+	zs_compact(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t pages_compacted_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		val = zs_get_pages_compacted(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	ret = sprintf(buf, "%s\n", zram->backing_dev_path ?
+			zram->backing_dev_path : "none");
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	char *copy, *path;
+	struct zram *zram = dev_to_zram(dev);
+
+	copy = kstrndup(buf, len, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+	path = strim(copy);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized "
+			"device\n");
+		ret = -EBUSY;
+	} else if (!*path) {
+		ret = -EINVAL;
+	} else {
+		ret = zram_set_backing_dev(zram, path);
+	}
+	mutex_unlock(&zram->init_lock);
+	kfree(copy);
+
+	return ret ? ret : len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	enum zram_wb_mode mode;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sysfs_streq(buf, "incompressible"))
+		mode = ZRAM_WB_INCOMPRESSIBLE;
+	else if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else if (sysfs_streq(buf, "all"))
+		mode = ZRAM_WB_ALL;
+	else
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+	ret = zram_writeback(zram, mode);
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t writeback_idle_secs_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->wb_idle_secs);
+}
+
+static ssize_t writeback_idle_secs_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+	if (val > UINT_MAX)
+		return -EINVAL;
+
+	zram->wb_idle_secs = val;
+
+	return len;
+}
+
+static ssize_t bd_count_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_count));
+}
+
+static ssize_t bd_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_reads));
+}
+
+static ssize_t bd_writes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_writes));
+}
+#endif
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
 static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
 static DEVICE_ATTR(num_reads, S_IRUGO, num_reads_show, NULL);
 static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
 static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
+static DEVICE_ATTR(same_pages, S_IRUGO, same_pages_show, NULL);
+static DEVICE_ATTR(dedup_enable, S_IRUGO | S_IWUSR,
+		dedup_enable_show, dedup_enable_store);
+static DEVICE_ATTR(dup_pages, S_IRUGO, dup_pages_show, NULL);
+static DEVICE_ATTR(dup_data_size, S_IRUGO, dup_data_size_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
+static DEVICE_ATTR(compr_ratio, S_IRUGO, compr_ratio_show, NULL);
+static DEVICE_ATTR(avg_comp_time, S_IRUGO, avg_comp_time_show, NULL);
+static DEVICE_ATTR(avg_decomp_time, S_IRUGO, avg_decomp_time_show, NULL);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(writeback_idle_secs, S_IRUGO | S_IWUSR,
+		writeback_idle_secs_show, writeback_idle_secs_store);
+static DEVICE_ATTR(bd_count, S_IRUGO, bd_count_show, NULL);
+static DEVICE_ATTR(bd_reads, S_IRUGO, bd_reads_show, NULL);
+static DEVICE_ATTR(bd_writes, S_IRUGO, bd_writes_show, NULL);
+#endif
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(pages_compacted, S_IRUGO, pages_compacted_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
 	&dev_attr_initstate.attr,
 	&dev_attr_reset.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_algorithm.attr,
 	&dev_attr_num_reads.attr,
 	&dev_attr_num_writes.attr,
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_dedup_enable.attr,
+	&dev_attr_dup_pages.attr,
+	&dev_attr_dup_data_size.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
+	&dev_attr_compr_ratio.attr,
+	&dev_attr_avg_comp_time.attr,
+	&dev_attr_avg_decomp_time.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_pages_compacted.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_writeback_idle_secs.attr,
+	&dev_attr_bd_count.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_writes.attr,
+#endif
 	NULL,
 };
 
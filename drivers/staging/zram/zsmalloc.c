@@ -0,0 +1,730 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped into size classes ZS_SIZE_CLASS_DELTA bytes apart.
+ * Each class allocates zspages, groups of 1..ZS_MAX_PAGES_PER_ZSPAGE
+ * pages sized to waste as little as possible, and packs its objects into
+ * them back to back, across page boundaries. Allocated objects are
+ * referred to by an opaque handle, so compaction can move them from
+ * sparsely used zspages into fuller ones and give the emptied pages
+ * back to the system.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/*
+ * Objects spanning two pages are accessed through a per-cpu copy. The
+ * class lock taken by zs_map_object() keeps preemption disabled until
+ * zs_unmap_object(), so mappings cannot nest on a cpu.
+ */
+struct mapping_area {
+	char *buf;
+	char *vaddr;		/* kmap address of a single page object */
+	struct page *pages[2];	/* pages of a spanning object */
+	unsigned int off;	/* offset of the object data in pages[0] */
+	unsigned int size;	/* size of the object data */
+	enum zs_mapmode mm;
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static struct kmem_cache *zs_handle_cachep;
+static struct kmem_cache *zspage_cachep;
+static struct dentry *zs_stat_root;
+
+static unsigned int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/* Number of pages per zspage which wastes the least space for @size */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, best_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int zspage_size = i * PAGE_SIZE;
+		unsigned int usedpc;
+
+		usedpc = (zspage_size / size) * size * 100 / zspage_size;
+		if (usedpc > best_usedpc) {
+			best_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static unsigned long obj_pos(struct size_class *class, unsigned int idx)
+{
+	return (unsigned long)idx * class->size;
+}
+
+static unsigned long obj_read_header(struct size_class *class,
+				struct zspage *zspage, unsigned int idx)
+{
+	unsigned long pos = obj_pos(class, idx);
+	unsigned long head;
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[pos >> PAGE_SHIFT], KM_USER0);
+	head = *(unsigned long *)(addr + (pos & ~PAGE_MASK));
+	kunmap_atomic(addr, KM_USER0);
+
+	return head;
+}
+
+static void obj_write_header(struct size_class *class, struct zspage *zspage,
+				unsigned int idx, unsigned long head)
+{
+	unsigned long pos = obj_pos(class, idx);
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[pos >> PAGE_SHIFT], KM_USER0);
+	*(unsigned long *)(addr + (pos & ~PAGE_MASK)) = head;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/* Copy a whole object, header included, between two slots of a class */
+static void obj_copy(struct size_class *class, struct zspage *dst,
+		unsigned int didx, struct zspage *src, unsigned int sidx)
+{
+	unsigned long spos = obj_pos(class, sidx);
+	unsigned long dpos = obj_pos(class, didx);
+	unsigned int left = class->size;
+
+	while (left) {
+		unsigned int soff = spos & ~PAGE_MASK;
+		unsigned int doff = dpos & ~PAGE_MASK;
+		unsigned int len;
+		void *s, *d;
+
+		len = min3(left, (unsigned int)PAGE_SIZE - soff,
+				(unsigned int)PAGE_SIZE - doff);
+
+		s = kmap_atomic(src->pages[spos >> PAGE_SHIFT], KM_USER0);
+		d = kmap_atomic(dst->pages[dpos >> PAGE_SHIFT], KM_USER1);
+		memcpy(d + doff, s + soff, len);
+		kunmap_atomic(d, KM_USER1);
+		kunmap_atomic(s, KM_USER0);
+
+		spos += len;
+		dpos += len;
+		left -= len;
+	}
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+						struct zspage *zspage)
+{
+	if (!zspage->inuse)
+		return ZS_EMPTY;
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * ZS_ALMOST_FULL_DEN <=
+			class->objs_per_zspage * ZS_ALMOST_FULL_NUM)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Put a zspage on the list matching its usage after objects were added
+ * or removed. Empty zspages are on no list; the caller frees them.
+ */
+static void fix_fullness_group(struct size_class *class, struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return;
+
+	if (zspage->fullness != ZS_EMPTY)
+		list_del(&zspage->list);
+	if (newfg != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+}
+
+/* Take the first free slot of a zspage, which must have one */
+static unsigned int obj_take_slot(struct size_class *class,
+				struct zspage *zspage)
+{
+	unsigned int idx = zspage->freeobj;
+
+	BUG_ON(idx == ZS_NO_FREE_OBJ);
+	zspage->freeobj = obj_read_header(class, zspage, idx) >>
+				OBJ_FREE_SHIFT;
+	zspage->inuse++;
+
+	return idx;
+}
+
+static void obj_put_slot(struct size_class *class, struct zspage *zspage,
+				unsigned int idx)
+{
+	obj_write_header(class, zspage, idx,
+			(unsigned long)zspage->freeobj << OBJ_FREE_SHIFT);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class, int class_idx)
+{
+	unsigned int i;
+	struct zspage *zspage;
+
+	zspage = kmem_cache_zalloc(zspage_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	/* Chain all objects on the free list, in address order */
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		unsigned long next = i + 1;
+
+		if (next == class->objs_per_zspage)
+			next = ZS_NO_FREE_OBJ;
+		obj_write_header(class, zspage, i, next << OBJ_FREE_SHIFT);
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->freeobj = 0;
+	zspage->class_idx = class_idx;
+	zspage->fullness = ZS_EMPTY;
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kmem_cache_free(zspage_cachep, zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+				struct zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+	kmem_cache_free(zspage_cachep, zspage);
+}
+
+/* Prefer the fullest zspages so sparse ones can drain */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int fg;
+
+	for (fg = ZS_ALMOST_FULL; fg >= ZS_ALMOST_EMPTY; fg--) {
+		if (!list_empty(&class->fullness_list[fg]))
+			return list_first_entry(&class->fullness_list[fg],
+						struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * Returns an opaque handle to the object, or 0 on failure. The object
+ * must be mapped with zs_map_object() to be accessed.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned int class_idx;
+	struct zs_obj *obj;
+	struct zspage *zspage;
+	struct size_class *class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	obj = kmem_cache_alloc(zs_handle_cachep, pool->flags & ~__GFP_HIGHMEM);
+	if (!obj)
+		return 0;
+
+	class_idx = get_size_class_index(size + ZS_HANDLE_SIZE);
+	class = &pool->size_class[class_idx];
+
+	write_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		write_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class, class_idx);
+		if (!zspage) {
+			kmem_cache_free(zs_handle_cachep, obj);
+			return 0;
+		}
+		write_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj->zspage = zspage;
+	obj->idx = obj_take_slot(class, zspage);
+	obj->class_idx = class_idx;
+	obj_write_header(class, zspage, obj->idx,
+			(unsigned long)obj | OBJ_ALLOCATED_TAG);
+	class->objs_inuse++;
+	fix_fullness_group(class, zspage);
+	write_unlock(&class->lock);
+
+	return (unsigned long)obj;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_obj *obj = (struct zs_obj *)handle;
+	struct zspage *zspage;
+	struct size_class *class;
+
+	if (unlikely(!handle))
+		return;
+
+	class = &pool->size_class[obj->class_idx];
+
+	write_lock(&class->lock);
+	zspage = obj->zspage;
+	obj_put_slot(class, zspage, obj->idx);
+	class->objs_inuse--;
+	fix_fullness_group(class, zspage);
+	if (zspage->fullness == ZS_EMPTY)
+		class->zspages--;
+	else
+		zspage = NULL;
+	write_unlock(&class->lock);
+
+	if (zspage)
+		free_zspage(pool, class, zspage);
+	kmem_cache_free(zs_handle_cachep, obj);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the object will be accessed
+ *
+ * The object stays in place until zs_unmap_object(), which must be
+ * called before sleeping or mapping another object. An object spanning
+ * two pages is mapped through a per-cpu copy; @mm avoids copying data
+ * in or back when it is not needed.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_obj *obj = (struct zs_obj *)handle;
+	struct mapping_area *area;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned long pos;
+	unsigned int off;
+	void *addr;
+
+	BUG_ON(!handle);
+
+	class = &pool->size_class[obj->class_idx];
+	read_lock(&class->lock);
+
+	zspage = obj->zspage;
+	pos = obj_pos(class, obj->idx) + ZS_HANDLE_SIZE;
+	off = pos & ~PAGE_MASK;
+
+	area = &__get_cpu_var(zs_map_area);
+	area->mm = mm;
+
+	if (off + class->size - ZS_HANDLE_SIZE <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(zspage->pages[pos >> PAGE_SHIFT],
+					KM_USER1);
+		return area->vaddr + off;
+	}
+
+	area->vaddr = NULL;
+	area->pages[0] = zspage->pages[pos >> PAGE_SHIFT];
+	area->pages[1] = zspage->pages[(pos >> PAGE_SHIFT) + 1];
+	area->off = off;
+	area->size = class->size - ZS_HANDLE_SIZE;
+
+	if (mm != ZS_MM_WO) {
+		unsigned int first = PAGE_SIZE - off;
+
+		addr = kmap_atomic(area->pages[0], KM_USER1);
+		memcpy(area->buf, addr + off, first);
+		kunmap_atomic(addr, KM_USER1);
+		addr = kmap_atomic(area->pages[1], KM_USER1);
+		memcpy(area->buf + first, addr, area->size - first);
+		kunmap_atomic(addr, KM_USER1);
+	}
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_obj *obj = (struct zs_obj *)handle;
+	struct mapping_area *area;
+	void *addr;
+
+	area = &__get_cpu_var(zs_map_area);
+
+	if (area->vaddr) {
+		kunmap_atomic(area->vaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		unsigned int first = PAGE_SIZE - area->off;
+
+		addr = kmap_atomic(area->pages[0], KM_USER1);
+		memcpy(addr + area->off, area->buf, first);
+		kunmap_atomic(addr, KM_USER1);
+		addr = kmap_atomic(area->pages[1], KM_USER1);
+		memcpy(addr, area->buf + first, area->size - first);
+		kunmap_atomic(addr, KM_USER1);
+	}
+
+	read_unlock(&pool->size_class[obj->class_idx].lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Any almost empty zspage will do as a source; take the oldest */
+static struct zspage *find_compact_src(struct size_class *class)
+{
+	struct list_head *head = &class->fullness_list[ZS_ALMOST_EMPTY];
+
+	if (list_empty(head))
+		return NULL;
+
+	return list_entry(head->prev, struct zspage, list);
+}
+
+static struct zspage *find_compact_dst(struct size_class *class,
+					struct zspage *src)
+{
+	struct zspage *zspage;
+	int fg;
+
+	for (fg = ZS_ALMOST_FULL; fg >= ZS_ALMOST_EMPTY; fg--) {
+		list_for_each_entry(zspage, &class->fullness_list[fg], list) {
+			if (zspage != src)
+				return zspage;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Move allocated objects from @src into free slots of @dst until one
+ * runs out, repointing their handles.
+ */
+static void migrate_zspage(struct size_class *class, struct zspage *src,
+				struct zspage *dst)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		unsigned long head = obj_read_header(class, src, idx);
+		struct zs_obj *obj;
+		unsigned int didx;
+
+		if (!(head & OBJ_ALLOCATED_TAG))
+			continue;
+		if (dst->freeobj == ZS_NO_FREE_OBJ)
+			break;
+
+		didx = obj_take_slot(class, dst);
+		obj_copy(class, dst, didx, src, idx);
+		obj_put_slot(class, src, idx);
+
+		obj = (struct zs_obj *)(head & ~OBJ_ALLOCATED_TAG);
+		obj->zspage = dst;
+		obj->idx = didx;
+		class->objs_migrated++;
+	}
+
+	fix_fullness_group(class, dst);
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *src, *dst;
+
+	write_lock(&class->lock);
+	while ((src = find_compact_src(class))) {
+		unsigned long free_slots;
+
+		/* Only go on if the other zspages can take all of src */
+		free_slots = class->zspages * class->objs_per_zspage -
+				class->objs_inuse;
+		if (free_slots - (class->objs_per_zspage - src->inuse) <
+				src->inuse)
+			break;
+
+		while (src->inuse && (dst = find_compact_dst(class, src)))
+			migrate_zspage(class, src, dst);
+
+		fix_fullness_group(class, src);
+		if (src->fullness != ZS_EMPTY)
+			break;
+		class->zspages--;
+		write_unlock(&class->lock);
+
+		free_zspage(pool, class, src);
+		freed += class->pages_per_zspage;
+		cond_resched();
+
+		write_lock(&class->lock);
+	}
+	write_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - release sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Moves objects of each size class out of its almost empty zspages into
+ * fuller ones and frees the zspages left empty. May sleep. Returns the
+ * number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+unsigned long zs_get_pages_compacted(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_pages_compacted);
+
+static int zs_stats_show(struct seq_file *s, void *v)
+{
+	struct zs_pool *pool = s->private;
+	unsigned long total_objs = 0, total_pages = 0;
+	int i;
+
+	seq_printf(s, "%5s %5s %6s %6s %8s %8s %8s %10s %10s %12s\n",
+		   "class", "size", "pages", "objs", "almost_e", "almost_f",
+		   "zspages", "objs_inuse", "pages_used", "migrated");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long almost_empty = 0, almost_full = 0;
+		unsigned long zspages, objs_inuse;
+		struct zspage *zspage;
+		u64 migrated;
+
+		read_lock(&class->lock);
+		list_for_each_entry(zspage,
+				&class->fullness_list[ZS_ALMOST_EMPTY], list)
+			almost_empty++;
+		list_for_each_entry(zspage,
+				&class->fullness_list[ZS_ALMOST_FULL], list)
+			almost_full++;
+		zspages = class->zspages;
+		objs_inuse = class->objs_inuse;
+		migrated = class->objs_migrated;
+		read_unlock(&class->lock);
+
+		if (!zspages && !migrated)
+			continue;
+
+		seq_printf(s, "%5d %5u %6u %6u %8lu %8lu %8lu %10lu %10lu "
+			   "%12llu\n", i, class->size,
+			   class->pages_per_zspage, class->objs_per_zspage,
+			   almost_empty, almost_full, zspages, objs_inuse,
+			   zspages * class->pages_per_zspage, migrated);
+
+		total_objs += objs_inuse;
+		total_pages += zspages * class->pages_per_zspage;
+	}
+
+	seq_printf(s, "total objs_inuse %lu pages_used %lu pages_compacted "
+		   "%lu\n", total_objs, total_pages,
+		   zs_get_pages_compacted(pool));
+	return 0;
+}
+
+static int zs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_fops = {
+	.open = zs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, used for its debugfs statistics
+ * @flags: allocation flags used to allocate pool pages
+ *
+ * Returns NULL if pool creation failed.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	struct zs_pool *pool;
+	int i, fg;
+
+	pool = vzalloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->name = kstrdup(name, GFP_KERNEL);
+	if (!pool->name) {
+		vfree(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		rwlock_init(&class->lock);
+		for (fg = 0; fg < __NR_ZS_FULLNESS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+					class->size;
+	}
+
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	if (!IS_ERR_OR_NULL(zs_stat_root))
+		pool->stat_dentry = debugfs_create_file(pool->name, S_IRUGO,
+					zs_stat_root, pool, &zs_stats_fops);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	struct zspage *zspage, *tmp;
+	int i, fg;
+
+	if (!IS_ERR_OR_NULL(pool->stat_dentry))
+		debugfs_remove(pool->stat_dentry);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = ZS_ALMOST_EMPTY; fg < __NR_ZS_FULLNESS; fg++) {
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				WARN_ON_ONCE(1);
+				pr_err("Freeing non-empty zspage: class=%d "
+					"inuse=%u\n", i, zspage->inuse);
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+	}
+
+	kfree(pool->name);
+	vfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle",
+				sizeof(struct zs_obj), 0, 0, NULL);
+	zspage_cachep = kmem_cache_create("zspage",
+				sizeof(struct zspage), 0, 0, NULL);
+	if (!zs_handle_cachep || !zspage_cachep)
+		goto fail;
+
+	/* Spanning objects are at most one size class delta over a page */
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->buf = (char *)__get_free_pages(GFP_KERNEL, 1);
+		if (!area->buf)
+			goto fail;
+	}
+
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu)
+		free_pages((unsigned long)per_cpu(zs_map_area, cpu).buf, 1);
+	if (zspage_cachep)
+		kmem_cache_destroy(zspage_cachep);
+	if (zs_handle_cachep)
+		kmem_cache_destroy(zs_handle_cachep);
+	return -ENOMEM;
+}
+module_init(zs_init);
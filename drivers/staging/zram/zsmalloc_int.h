@@ -0,0 +1,118 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/*
+ * A zspage is a group of up to this many order-0 pages which objects of
+ * a single size class are packed into, back to back. Objects may span
+ * the boundary between two pages of a zspage.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Every object is prefixed by a word holding its handle while allocated,
+ * or the index of the next free object while free.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA bytes apart: 16 bytes for 4k
+ * pages. This keeps object headers aligned and never lets a header
+ * cross a page boundary.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		(DIV_ROUND_UP(ZS_MAX_ALLOC_SIZE + \
+				ZS_HANDLE_SIZE - ZS_MIN_ALLOC_SIZE, \
+				ZS_SIZE_CLASS_DELTA) + 1)
+
+/*
+ * A zspage using at most this fraction of its objects is considered
+ * almost empty, and is a candidate to be emptied by compaction.
+ */
+#define ZS_ALMOST_FULL_NUM	3
+#define ZS_ALMOST_FULL_DEN	4
+
+/* End of user params */
+
+/* Bit 0 of an object header is set while the object is allocated */
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_FREE_SHIFT		1
+#define ZS_NO_FREE_OBJ		0xffff
+
+enum fullness_group {
+	ZS_EMPTY,
+	ZS_ALMOST_EMPTY,
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	__NR_ZS_FULLNESS,
+};
+
+struct zspage {
+	struct list_head list;	/* in class->fullness_list[fullness] */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	u16 inuse;		/* allocated objects */
+	u16 freeobj;		/* first free object or ZS_NO_FREE_OBJ */
+	u16 class_idx;
+	u16 fullness;
+};
+
+/*
+ * Handles given out by zs_malloc() point to one of these, so objects
+ * can be moved by compaction without the caller noticing. class_idx
+ * never changes for the lifetime of an object.
+ */
+struct zs_obj {
+	struct zspage *zspage;
+	u16 idx;
+	u16 class_idx;
+};
+
+struct size_class {
+	/*
+	 * Mapping an object takes this for read; allocating, freeing and
+	 * moving objects take it for write.
+	 */
+	rwlock_t lock;
+	unsigned int size;		/* object size, including header */
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	struct list_head fullness_list[__NR_ZS_FULLNESS];
+
+	/* stats, protected by lock */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+	u64 objs_migrated;
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;
+	struct dentry *stat_dentry;
+};
+
+#endif
@@ -1067,6 +1067,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	oom_adj_index_update(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1202,6 +1203,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	oom_adj_index_update(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -2786,6 +2788,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 	REG("mountstats", S_IRUSR, proc_mountstats_operations),
 #ifdef CONFIG_PROC_PAGE_MONITOR
 	REG("clear_refs", S_IWUSR, proc_clear_refs_operations),
+#ifdef CONFIG_PROCESS_RECLAIM
+	REG("reclaim", S_IWUSR, proc_reclaim_operations),
+#endif
 	REG("smaps",      S_IRUGO, proc_smaps_operations),
 	REG("pagemap",    S_IRUGO, proc_pagemap_operations),
 #endif
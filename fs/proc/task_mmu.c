@@ -11,6 +11,7 @@
 #include <linux/rmap.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/mm_inline.h>
 
 #include <asm/elf.h>
 #include <asm/uaccess.h>
@@ -601,6 +602,134 @@ const struct file_operations proc_clear_refs_operations = {
 	.llseek		= noop_llseek,
 };
 
+#ifdef CONFIG_PROCESS_RECLAIM
+enum reclaim_type {
+	RECLAIM_FILE,
+	RECLAIM_ANON,
+	RECLAIM_ALL,
+};
+
+struct reclaim_param {
+	struct vm_area_struct *vma;
+	enum reclaim_type type;
+};
+
+static int reclaim_pte_range(pmd_t *pmd, unsigned long addr,
+			     unsigned long end, struct mm_walk *walk)
+{
+	struct reclaim_param *rp = walk->private;
+	struct vm_area_struct *vma = rp->vma;
+	pte_t *pte, ptent;
+	spinlock_t *ptl;
+	struct page *page;
+	LIST_HEAD(page_list);
+	int file;
+
+	split_huge_page_pmd(walk->mm, pmd);
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		ptent = *pte;
+		if (!pte_present(ptent))
+			continue;
+
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || !PageLRU(page))
+			continue;
+
+		/* Leave pages that other processes are using alone */
+		if (page_mapcount(page) != 1)
+			continue;
+
+		/* Shmem and ashmem go to swap, so they count as anon */
+		file = page_is_file_cache(page);
+		if ((rp->type == RECLAIM_FILE && !file) ||
+		    (rp->type == RECLAIM_ANON && file))
+			continue;
+
+		if (isolate_lru_page(page))
+			continue;
+		inc_zone_page_state(page, NR_ISOLATED_ANON + file);
+		list_add(&page->lru, &page_list);
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+
+	if (!list_empty(&page_list))
+		reclaim_pages_from_list(&page_list);
+	cond_resched();
+	return 0;
+}
+
+static ssize_t reclaim_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct task_struct *task;
+	char buffer[PROC_NUMBUF];
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	struct reclaim_param rp;
+	char *type_buf;
+
+	memset(buffer, 0, sizeof(buffer));
+	if (count > sizeof(buffer) - 1)
+		count = sizeof(buffer) - 1;
+	if (copy_from_user(buffer, buf, count))
+		return -EFAULT;
+
+	type_buf = strstrip(buffer);
+	if (!strcmp(type_buf, "file"))
+		rp.type = RECLAIM_FILE;
+	else if (!strcmp(type_buf, "anon"))
+		rp.type = RECLAIM_ANON;
+	else if (!strcmp(type_buf, "all"))
+		rp.type = RECLAIM_ALL;
+	else
+		return -EINVAL;
+
+	task = get_proc_task(file->f_path.dentry->d_inode);
+	if (!task)
+		return -ESRCH;
+	mm = get_task_mm(task);
+	if (mm) {
+		struct mm_walk reclaim_walk = {
+			.pmd_entry = reclaim_pte_range,
+			.mm = mm,
+			.private = &rp,
+		};
+		down_read(&mm->mmap_sem);
+		for (vma = mm->mmap; vma; vma = vma->vm_next) {
+			if (is_vm_hugetlb_page(vma))
+				continue;
+			if (vma->vm_flags & (VM_LOCKED | VM_PFNMAP | VM_IO))
+				continue;
+			/* Private file mappings may still hold anon COW pages */
+			if (rp.type == RECLAIM_ANON && !vma->anon_vma &&
+			    !(vma->vm_flags & VM_SHARED))
+				continue;
+			if (rp.type == RECLAIM_FILE && !vma->vm_file)
+				continue;
+			rp.vma = vma;
+			walk_page_range(vma->vm_start, vma->vm_end,
+					&reclaim_walk);
+			if (fatal_signal_pending(current))
+				break;
+		}
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	put_task_struct(task);
+
+	return count;
+}
+
+const struct file_operations proc_reclaim_operations = {
+	.write		= reclaim_write,
+	.llseek		= noop_llseek,
+};
+#endif
+
 struct pagemapread {
 	int pos, len;
 	u64 *buffer;
@@ -22,6 +22,7 @@
 /* Return values from ASHMEM_PIN: Was the mapping purged while unpinned? */
 #define ASHMEM_NOT_PURGED	0
 #define ASHMEM_WAS_PURGED	1
+#define ASHMEM_WAS_RESTORED	2	/* purged, but the data was kept */
 
 /* Return values from ASHMEM_GET_PIN_STATUS: Is the mapping pinned? */
 #define ASHMEM_IS_UNPINNED	0
@@ -24,6 +24,9 @@ extern unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			int order, gfp_t gfp_mask, nodemask_t *mask,
 			bool sync);
 extern unsigned long compaction_suitable(struct zone *zone, int order);
+extern void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx);
+extern int kcompactd_run(int nid);
+extern void kcompactd_stop(int nid);
 #ifdef CONFIG_COMPACTION_RETRY
 extern unsigned long compact_zone_order(struct zone *zone, int order,
 					       gfp_t gfp_mask, bool sync);
@@ -85,6 +88,20 @@ static inline bool compaction_deferred(struct zone *zone)
 	return 1;
 }
 
+static inline void wakeup_kcompactd(pg_data_t *pgdat, int order,
+				    int classzone_idx)
+{
+}
+
+static inline int kcompactd_run(int nid)
+{
+	return 0;
+}
+
+static inline void kcompactd_stop(int nid)
+{
+}
+
 #endif /* CONFIG_COMPACTION */
 
 #if defined(CONFIG_COMPACTION) && defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
@@ -117,6 +117,13 @@ extern struct group_info init_groups;
 
 extern struct cred init_cred;
 
+#ifdef CONFIG_OOM_ADJ_INDEX
+# define INIT_OOM_ADJ_INDEX(tsk)					\
+	.oom_adj_node = LIST_HEAD_INIT(tsk.oom_adj_node),
+#else
+# define INIT_OOM_ADJ_INDEX(tsk)
+#endif
+
 #ifdef CONFIG_PERF_EVENTS
 # define INIT_PERF_EVENTS(tsk)					\
 	.perf_event_mutex = 						\
@@ -187,6 +194,7 @@ extern struct cred init_cred;
 	.thread_group	= LIST_HEAD_INIT(tsk.thread_group),		\
 	.dirties = INIT_PROP_LOCAL_SINGLE(dirties),			\
 	INIT_IDS							\
+	INIT_OOM_ADJ_INDEX(tsk)						\
 	INIT_PERF_EVENTS(tsk)						\
 	INIT_TRACE_IRQFLAGS						\
 	INIT_LOCKDEP							\
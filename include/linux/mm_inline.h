@@ -21,6 +21,198 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+#ifdef CONFIG_LRU_GEN
+
+extern bool __lru_gen_enabled;
+
+/*
+ * Whether evictable pages are put on the multi-gen LRU. Pages added while
+ * it was in the other state are moved over when it is switched, so both
+ * kinds of lists may hold pages for a short while.
+ */
+static inline bool lru_gen_enabled(void)
+{
+	return __lru_gen_enabled;
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* Returns the generation of @page, or -1 if it is not on the multi-gen LRU */
+static inline int page_lru_gen(struct page *page)
+{
+	return ((page->flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+}
+
+/*
+ * Sets the generation of @page, -1 taking it off the multi-gen LRU, and
+ * returns the old one. PG_active is cleared as well: the generation says
+ * how active the page is. Other flags may change under us, so this has to
+ * be atomic even though the generation itself only changes under lru_lock.
+ */
+static inline int page_set_lru_gen(struct page *page, int gen)
+{
+	unsigned long old_flags, new_flags;
+
+	do {
+		old_flags = ACCESS_ONCE(page->flags);
+		new_flags = old_flags & ~(LRU_GEN_MASK | (1UL << PG_active));
+		new_flags |= (gen + 1UL) << LRU_GEN_PGOFF;
+	} while (cmpxchg(&page->flags, old_flags, new_flags) != old_flags);
+
+	return ((old_flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+}
+
+/* The two youngest generations are reported as the active lists */
+static inline bool lru_gen_is_active(struct zone *zone, int gen)
+{
+	unsigned long max_seq = zone->lrugen.max_seq;
+
+	return gen == lru_gen_from_seq(max_seq) ||
+	       gen == lru_gen_from_seq(max_seq - 1);
+}
+
+/*
+ * Whether @page counts as active. Without lru_lock the answer may be
+ * stale, which is good enough for the callers using it as a hint.
+ */
+static inline bool page_lru_active(struct page *page)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return PageActive(page);
+	return lru_gen_is_active(page_zone(page), gen);
+}
+
+static inline void lru_gen_update_size(struct zone *zone, struct page *page,
+				       int old_gen, int new_gen)
+{
+	int type = page_is_file_cache(page);
+	int delta = hpage_nr_pages(page);
+	enum lru_list l = LRU_BASE + type * LRU_FILE;
+
+	if (old_gen >= 0) {
+		zone->lrugen.nr_pages[old_gen][type] -= delta;
+		__mod_zone_page_state(zone, NR_LRU_BASE + l +
+			lru_gen_is_active(zone, old_gen) * LRU_ACTIVE, -delta);
+	}
+	if (new_gen >= 0) {
+		zone->lrugen.nr_pages[new_gen][type] += delta;
+		__mod_zone_page_state(zone, NR_LRU_BASE + l +
+			lru_gen_is_active(zone, new_gen) * LRU_ACTIVE, delta);
+	}
+}
+
+/*
+ * Activated pages start out in the youngest generation, which also puts
+ * back pages taken off while in one of the two youngest. Fresh anon pages
+ * and pages queued for writeback by reclaim go one above the oldest, so
+ * they are not looked at again by the very next eviction pass, and all
+ * other pages into the oldest generation. @reclaiming puts the page at
+ * the tail, to be evicted first.
+ */
+static inline bool lru_gen_add_page(struct zone *zone, struct page *page,
+				    bool reclaiming)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	int type = page_is_file_cache(page);
+	unsigned long seq;
+	int gen;
+
+	if (!lru_gen_enabled() || PageUnevictable(page))
+		return false;
+
+	if (PageActive(page))
+		seq = lrugen->max_seq;
+	else if ((!type && !PageSwapCache(page)) ||
+		 (PageReclaim(page) &&
+		  (PageDirty(page) || PageWriteback(page))))
+		seq = lrugen->min_seq[type] + 1;
+	else
+		seq = lrugen->min_seq[type];
+
+	gen = lru_gen_from_seq(seq);
+	page_set_lru_gen(page, gen);
+	lru_gen_update_size(zone, page, -1, gen);
+	if (reclaiming)
+		list_add_tail(&page->lru, &lrugen->lists[gen][type]);
+	else
+		list_add(&page->lru, &lrugen->lists[gen][type]);
+
+	return true;
+}
+
+/*
+ * Pages isolated for anything but eviction or freeing keep PG_active if
+ * they were in one of the two youngest generations, so that putting them
+ * back or migrating them does not age them to the oldest.
+ */
+static inline bool lru_gen_del_page(struct zone *zone, struct page *page,
+				    bool reclaiming)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	list_del(&page->lru);
+	page_set_lru_gen(page, -1);
+	lru_gen_update_size(zone, page, gen, -1);
+	if (!reclaiming && lru_gen_is_active(zone, gen))
+		SetPageActive(page);
+
+	return true;
+}
+
+/* Moves @page to be evicted next, if it is on the multi-gen LRU */
+static inline bool lru_gen_rotate_page(struct zone *zone, struct page *page)
+{
+	if (!lru_gen_del_page(zone, page, true))
+		return false;
+
+	lru_gen_add_page(zone, page, true);
+	return true;
+}
+
+#else /* !CONFIG_LRU_GEN */
+
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline int page_lru_gen(struct page *page)
+{
+	return -1;
+}
+
+static inline bool page_lru_active(struct page *page)
+{
+	return PageActive(page);
+}
+
+static inline bool lru_gen_add_page(struct zone *zone, struct page *page,
+				    bool reclaiming)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct zone *zone, struct page *page,
+				    bool reclaiming)
+{
+	return false;
+}
+
+static inline bool lru_gen_rotate_page(struct zone *zone, struct page *page)
+{
+	return false;
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static inline void
 __add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l,
 		       struct list_head *head)
@@ -33,12 +225,16 @@ __add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l,
 static inline void
 add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
+	if (lru_gen_add_page(zone, page, false))
+		return;
 	__add_page_to_lru_list(zone, page, l, &zone->lru[l].list);
 }
 
 static inline void
 del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
+	if (lru_gen_del_page(zone, page, false))
+		return;
 	list_del(&page->lru);
 	__mod_zone_page_state(zone, NR_LRU_BASE + l, -hpage_nr_pages(page));
 	mem_cgroup_del_lru_list(page, l);
@@ -64,6 +260,8 @@ del_page_from_lru(struct zone *zone, struct page *page)
 {
 	enum lru_list l;
 
+	if (lru_gen_del_page(zone, page, true))
+		return;
 	list_del(&page->lru);
 	if (PageUnevictable(page)) {
 		__ClearPageUnevictable(page);
@@ -327,6 +327,10 @@ struct mm_struct {
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
 #endif
+#ifdef CONFIG_LRU_GEN
+	/* On the list of mms whose page tables are walked for aging */
+	struct list_head lru_gen_list;
+#endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
@@ -132,6 +132,10 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	NR_VMSCAN_SCANNED,	/* inactive pages scanned by global reclaim */
+	NR_VMSCAN_RECLAIMED,	/* ... and reclaimed by it, since bootup */
+	WORKINGSET_REFAULT,	/* evicted file pages read back in */
+	WORKINGSET_ACTIVATE,	/* ... and activated by their distance */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -185,6 +189,28 @@ static inline int is_unevictable_lru(enum lru_list l)
 	return (l == LRU_UNEVICTABLE);
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-gen LRU sorts the evictable pages of a zone into generations
+ * instead of an active and an inactive list. Generations are numbered by
+ * ever increasing sequence numbers: max_seq is the youngest, shared by
+ * anon and file pages, and min_seq[] the oldest one of each type. Pages
+ * are evicted from the oldest generation; aging creates a new youngest
+ * generation and moves pages found accessed into it. The generation of a
+ * page, seq % MAX_NR_GENS, is kept in page->flags. All of it is protected
+ * by zone->lru_lock.
+ */
+#define MIN_NR_GENS		2U
+#define MAX_NR_GENS		4U
+
+struct lru_gen {
+	unsigned long max_seq;
+	unsigned long min_seq[2];
+	struct list_head lists[MAX_NR_GENS][2];
+	long nr_pages[MAX_NR_GENS][2];
+};
+#endif
+
 enum zone_watermarks {
 	WMARK_MIN,
 	WMARK_LOW,
@@ -367,6 +393,13 @@ struct zone {
 	 */
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
+
+	/*
+	 * Where kcompactd left the migrate and free scanners, so that its
+	 * next pass carries on from there. 0 when it starts from scratch.
+	 */
+	unsigned long		compact_cached_migrate_pfn;
+	unsigned long		compact_cached_free_pfn;
 #endif
 
 	ZONE_PADDING(_pad1_)
@@ -378,6 +411,12 @@ struct zone {
 	} lru[NR_LRU_LISTS];
 
 	struct zone_reclaim_stat reclaim_stat;
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen		lrugen;
+#endif
+
+	/* Evictions and activations, the clock of refault distances */
+	atomic_long_t		inactive_age;
 
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
@@ -669,6 +708,13 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	spinlock_t kcompactd_lock;	/* protects the request below */
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
@@ -42,6 +42,49 @@ enum oom_constraint {
 
 extern int test_set_oom_score_adj(int new_val);
 
+#ifdef CONFIG_OOM_ADJ_INDEX
+/*
+ * Index of all thread group leaders, bucketed by signal->oom_adj, so that
+ * a killer looking for the task with the highest oom_adj does not have to
+ * walk every process. Protected by oom_adj_index_lock, which nests inside
+ * tasklist_lock and the sighand lock and is taken with interrupts disabled.
+ * Anybody holding it may only trylock task_lock() and must not signal.
+ */
+#define OOM_ADJ_INDEX_SIZE	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+extern spinlock_t oom_adj_index_lock;
+extern struct list_head oom_adj_index[OOM_ADJ_INDEX_SIZE];
+
+static inline struct list_head *oom_adj_index_bucket(int oom_adj)
+{
+	return &oom_adj_index[clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX) -
+			      OOM_DISABLE];
+}
+
+extern void oom_adj_index_add(struct task_struct *p);
+extern void oom_adj_index_del(struct task_struct *p);
+extern void oom_adj_index_replace(struct task_struct *old,
+				  struct task_struct *new);
+extern void oom_adj_index_update(struct task_struct *p);
+#else
+static inline void oom_adj_index_add(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_index_del(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_index_replace(struct task_struct *old,
+					 struct task_struct *new)
+{
+}
+
+static inline void oom_adj_index_update(struct task_struct *p)
+{
+}
+#endif
+
 extern unsigned int oom_badness(struct task_struct *p, struct mem_cgroup *mem,
 			const nodemask_t *nodemask, unsigned long totalpages);
 extern int try_set_zonelist_oom(struct zonelist *zonelist, gfp_t gfp_flags);
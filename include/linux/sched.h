@@ -1280,6 +1280,9 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_OOM_ADJ_INDEX
+	struct list_head oom_adj_node;	/* group leaders, by oom_adj */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
@@ -204,6 +204,12 @@ struct swap_list_t {
 /* Swap 50% full? Release swapcache more aggressively.. */
 #define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
 
+/* linux/mm/workingset.c */
+extern void *workingset_eviction(struct page *page);
+extern bool workingset_refault(void *shadow);
+extern void workingset_activation(struct page *page);
+extern void workingset_forget(void);
+
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
 extern unsigned long totalreserve_pages;
@@ -222,6 +228,7 @@ extern void lru_add_page_tail(struct zone* zone,
 extern void activate_page(struct page *);
 extern void mark_page_accessed(struct page *);
 extern void lru_add_drain(void);
+extern void lru_add_pressure(void);
 extern int lru_add_drain_all(void);
 extern void rotate_reclaimable_page(struct page *page);
 extern void deactivate_page(struct page *page);
@@ -260,11 +267,34 @@ extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						struct zone *zone,
 						unsigned long *nr_scanned);
 extern int __isolate_lru_page(struct page *page, int mode, int file);
+extern int isolate_lru_page(struct page *page);
+extern void putback_lru_page(struct page *page);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
 extern int remove_mapping(struct address_space *mapping, struct page *page);
+extern unsigned long reclaim_pages_from_list(struct list_head *page_list);
 extern long vm_total_pages;
 
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_init_zone(struct zone *zone);
+extern void lru_gen_init_mm(struct mm_struct *mm);
+extern void lru_gen_add_mm(struct mm_struct *mm);
+extern void lru_gen_del_mm(struct mm_struct *mm);
+#else
+static inline void lru_gen_init_zone(struct zone *zone)
+{
+}
+static inline void lru_gen_init_mm(struct mm_struct *mm)
+{
+}
+static inline void lru_gen_add_mm(struct mm_struct *mm)
+{
+}
+static inline void lru_gen_del_mm(struct mm_struct *mm)
+{
+}
+#endif
+
 #ifdef CONFIG_NUMA
 extern int zone_reclaim_mode;
 extern int sysctl_min_unmapped_ratio;
@@ -17,6 +17,8 @@
 #define _LINUX_WAKELOCK_H
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
 #include <linux/ktime.h>
 
 /* A wake_lock prevents the system from entering suspend or other low power
@@ -35,6 +37,8 @@ enum {
 struct wake_lock {
 #ifdef CONFIG_HAS_WAKELOCK
 	struct list_head    link;
+	struct rb_node      node;
+	spinlock_t          lock;
 	int                 flags;
 	const char         *name;
 	unsigned long       expires;
@@ -47,6 +51,7 @@ struct wake_lock {
 		ktime_t         prevent_suspend_time;
 		ktime_t         max_time;
 		ktime_t         last_time;
+		ktime_t         prevent_suspend_start;
 	} stat;
 #endif
 #endif
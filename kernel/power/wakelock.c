@@ -40,10 +40,20 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define WAKE_LOCK_AUTO_EXPIRE            (1U << 10)
 #define WAKE_LOCK_PREVENTING_SUSPEND     (1U << 11)
 
+/*
+ * Every initialized wake lock sits on wake_locks. An active lock with a
+ * timeout is also kept on expire_locks[type], sorted by expiry; an active
+ * lock without one is only counted in active_count[type]. Each lock's
+ * flags and stats are protected by lock->lock, so locking and unlocking a
+ * wake lock without a timeout never takes list_lock. list_lock protects
+ * the list, the expire trees and the expire timer, and nests outside
+ * lock->lock.
+ */
 static DEFINE_SPINLOCK(list_lock);
-static LIST_HEAD(inactive_locks);
-static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
-static int current_event_num;
+static LIST_HEAD(wake_locks);
+static atomic_t active_count[WAKE_LOCK_TYPE_COUNT];
+static struct rb_root expire_locks[WAKE_LOCK_TYPE_COUNT];
+static atomic_t current_event_num;
 static int suspend_sys_sync_count;
 static DEFINE_SPINLOCK(suspend_sys_sync_lock);
 static struct workqueue_struct *suspend_sys_sync_work_queue;
@@ -61,7 +71,6 @@ static unsigned suspend_short_count;
 
 #ifdef CONFIG_WAKELOCK_STAT
 static struct wake_lock deleted_wake_locks;
-static ktime_t last_sleep_time_update;
 static int wait_for_wakeup;
 
 int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
@@ -110,7 +119,7 @@ static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 		total_time = ktime_add(total_time, add_time);
 		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
 			prevent_suspend_time = ktime_add(prevent_suspend_time,
-					ktime_sub(now, last_sleep_time_update));
+				ktime_sub(now, lock->stat.prevent_suspend_start));
 		if (add_time.tv64 > max_time.tv64)
 			max_time = add_time;
 	}
@@ -129,33 +138,60 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 	unsigned long irqflags;
 	struct wake_lock *lock;
 	int ret;
-	int type;
 
 	spin_lock_irqsave(&list_lock, irqflags);
 
 	ret = seq_puts(m, "name\tcount\texpire_count\twake_count\tactive_since"
 			"\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
-	list_for_each_entry(lock, &inactive_locks, link) {
-		if (!lock)
-			goto active_list;
-
+	list_for_each_entry(lock, &wake_locks, link) {
+		spin_lock(&lock->lock);
 		ret = print_lock_stat(m, lock);
+		spin_unlock(&lock->lock);
 	}
-active_list:
-	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
-		list_for_each_entry(lock, &active_wake_locks[type], link) {
-			if (!lock)
-				goto exit;
-
-			ret = print_lock_stat(m, lock);
-		}
-	}
-
-exit:
 	spin_unlock_irqrestore(&list_lock, irqflags);
 	return 0;
 }
 
+static void wake_lock_start_preventing(struct wake_lock *lock, ktime_t now)
+{
+	if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
+		return;
+	lock->stat.prevent_suspend_start = now;
+	lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
+}
+
+static void wake_lock_stop_preventing(struct wake_lock *lock, ktime_t now)
+{
+	ktime_t duration;
+
+	if (!(lock->flags & WAKE_LOCK_PREVENTING_SUSPEND))
+		return;
+	duration = ktime_sub(now, lock->stat.prevent_suspend_start);
+	lock->stat.prevent_suspend_time = ktime_add(
+		lock->stat.prevent_suspend_time, duration);
+	lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
+}
+
+/* Caller must hold lock->lock */
+static void wake_lock_stat_locked(struct wake_lock *lock, int type)
+{
+	ktime_t now = ktime_get();
+
+	if (type == WAKE_LOCK_SUSPEND && wait_for_wakeup &&
+	    xchg(&wait_for_wakeup, 0)) {
+		if (debug_mask & DEBUG_WAKEUP)
+			pr_info("wakeup wake lock: %s\n", lock->name);
+		lock->stat.wakeup_count++;
+	}
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		lock->stat.last_time = now;
+	/* Time spent holding a lock while main is released prevents suspend */
+	if (type == WAKE_LOCK_SUSPEND && lock != &main_wake_lock &&
+	    !wake_lock_active(&main_wake_lock))
+		wake_lock_start_preventing(lock, now);
+}
+
+/* Caller must hold lock->lock */
 static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 {
 	ktime_t duration;
@@ -174,50 +210,77 @@ static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 	if (ktime_to_ns(duration) > ktime_to_ns(lock->stat.max_time))
 		lock->stat.max_time = duration;
 	lock->stat.last_time = ktime_get();
-	if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-		duration = ktime_sub(now, last_sleep_time_update);
-		lock->stat.prevent_suspend_time = ktime_add(
-			lock->stat.prevent_suspend_time, duration);
-		lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
-	}
+	wake_lock_stop_preventing(lock, now);
 }
 
+/*
+ * Called when main_wake_lock is taken (done) or released. Caller must hold
+ * list_lock but not the lock of any wake lock.
+ */
 static void update_sleep_wait_stats_locked(int done)
 {
 	struct wake_lock *lock;
-	ktime_t now, etime, elapsed, add;
+	ktime_t now, etime;
 	int expired;
 
 	now = ktime_get();
-	elapsed = ktime_sub(now, last_sleep_time_update);
-	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND], link) {
-		expired = get_expired_time(lock, &etime);
-		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-			if (expired)
-				add = ktime_sub(etime, last_sleep_time_update);
+	list_for_each_entry(lock, &wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != WAKE_LOCK_SUSPEND ||
+		    lock == &main_wake_lock)
+			continue;
+		spin_lock(&lock->lock);
+		if (lock->flags & WAKE_LOCK_ACTIVE) {
+			expired = get_expired_time(lock, &etime);
+			if (done || expired)
+				wake_lock_stop_preventing(lock,
+							  expired ? etime : now);
 			else
-				add = elapsed;
-			lock->stat.prevent_suspend_time = ktime_add(
-				lock->stat.prevent_suspend_time, add);
+				wake_lock_start_preventing(lock, now);
 		}
-		if (done || expired)
-			lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
-		else
-			lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
+		spin_unlock(&lock->lock);
 	}
-	last_sleep_time_update = now;
 }
 #endif
 
 
+/* Caller must hold list_lock */
+static void wake_lock_insert_expire_locked(struct wake_lock *lock, int type)
+{
+	struct rb_node **p = &expire_locks[type].rb_node;
+	struct rb_node *parent = NULL;
+	struct wake_lock *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct wake_lock, node);
+		if (time_before(lock->expires, entry->expires))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&lock->node, parent, p);
+	rb_insert_color(&lock->node, &expire_locks[type]);
+}
+
+/* Caller must hold list_lock and lock->lock */
+static void wake_lock_deactivate_locked(struct wake_lock *lock, int type)
+{
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		return;
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		rb_erase(&lock->node, &expire_locks[type]);
+	else
+		atomic_dec(&active_count[type]);
+	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
+}
+
+/* Caller must hold list_lock and lock->lock */
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
-	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
+	wake_lock_deactivate_locked(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
 }
@@ -229,7 +292,10 @@ static void print_active_locks(int type)
 	bool print_expired = true;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry(lock, &active_wake_locks[type], link) {
+	list_for_each_entry(lock, &wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != type ||
+		    !(lock->flags & WAKE_LOCK_ACTIVE))
+			continue;
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
 			if (timeout > 0)
@@ -245,23 +311,28 @@ static void print_active_locks(int type)
 	}
 }
 
+/* Caller must acquire the list_lock spinlock */
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct rb_node *node;
+	struct wake_lock *lock;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	if (atomic_read(&active_count[type]))
+		return -1;
+	while ((node = rb_first(&expire_locks[type]))) {
+		lock = rb_entry(node, struct wake_lock, node);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		spin_lock(&lock->lock);
+		expire_wake_lock(lock);
+		spin_unlock(&lock->lock);
 	}
-	return max_timeout;
+	node = rb_last(&expire_locks[type]);
+	if (!node)
+		return 0;
+	lock = rb_entry(node, struct wake_lock, node);
+	return lock->expires - jiffies;
 }
 
 #ifdef FEATURE_FTM_SLEEP
@@ -292,7 +363,10 @@ void debug_print_active_locks(int type, char **buf)
 	bool print_expired = true;
 	int lock_count = 0;
 
-	list_for_each_entry(lock, &active_wake_locks[type], link) {
+	list_for_each_entry(lock, &wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != type ||
+		    !(lock->flags & WAKE_LOCK_ACTIVE))
+			continue;
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
 			if (timeout > 0)
@@ -307,7 +381,10 @@ void debug_print_active_locks(int type, char **buf)
 		goto endofprint;
 	}
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry(lock, &active_wake_locks[type], link) {
+	list_for_each_entry(lock, &wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != type ||
+		    !(lock->flags & WAKE_LOCK_ACTIVE))
+			continue;
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
 
@@ -413,7 +490,7 @@ static void suspend(struct work_struct *work)
 		return;
 	}
 
-	entry_event_num = current_event_num;
+	entry_event_num = atomic_read(&current_event_num);
 
 	/*run sys_sync workqueue*/
 	suspend_sys_sync_queue();
@@ -445,7 +522,7 @@ static void suspend(struct work_struct *work)
 		suspend_short_count = 0;
 	}
 
-	if (current_event_num == entry_event_num) {
+	if (atomic_read(&current_event_num) == entry_event_num) {
 		if (debug_mask & DEBUG_SUSPEND)
 			pr_info("suspend: pm_suspend returned with no event\n");
 		wake_lock_timeout(&unknown_wakeup, HZ / 2);
@@ -471,6 +548,25 @@ static void expire_wake_locks(unsigned long data)
 }
 static DEFINE_TIMER(expire_timer, expire_wake_locks, 0, 0);
 
+/* Caller must acquire the list_lock spinlock */
+static void update_expire_timer_locked(struct wake_lock *lock, const char *op,
+				       long expire_in)
+{
+	if (expire_in > 0) {
+		if (debug_mask & DEBUG_EXPIRE)
+			pr_info("%s: %s, start expire timer, %ld\n",
+				op, lock->name, expire_in);
+		mod_timer(&expire_timer, jiffies + expire_in);
+	} else {
+		if (del_timer(&expire_timer))
+			if (debug_mask & DEBUG_EXPIRE)
+				pr_info("%s: %s, stop expire timer\n",
+					op, lock->name);
+		if (expire_in == 0)
+			queue_work(suspend_work_queue, &suspend_work);
+	}
+}
+
 static int power_suspend_late(struct device *dev)
 {
 	int ret = has_wake_lock(WAKE_LOCK_SUSPEND) ? -EAGAIN : 0;
@@ -512,12 +608,15 @@ void wake_lock_init(struct wake_lock *lock, int type, const char *name)
 	lock->stat.prevent_suspend_time = ktime_set(0, 0);
 	lock->stat.max_time = ktime_set(0, 0);
 	lock->stat.last_time = ktime_set(0, 0);
+	lock->stat.prevent_suspend_start = ktime_set(0, 0);
 #endif
 	lock->flags = (type & WAKE_LOCK_TYPE_MASK) | WAKE_LOCK_INITIALIZED;
 
+	spin_lock_init(&lock->lock);
+	RB_CLEAR_NODE(&lock->node);
 	INIT_LIST_HEAD(&lock->link);
 	spin_lock_irqsave(&list_lock, irqflags);
-	list_add(&lock->link, &inactive_locks);
+	list_add(&lock->link, &wake_locks);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_init);
@@ -528,6 +627,8 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
+	spin_lock(&lock->lock);
+	wake_lock_deactivate_locked(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
 	lock->flags &= ~WAKE_LOCK_INITIALIZED;
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
@@ -544,11 +645,43 @@ void wake_lock_destroy(struct wake_lock *lock)
 				  lock->stat.max_time);
 	}
 #endif
+	spin_unlock(&lock->lock);
 	list_del(&lock->link);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_destroy);
 
+/*
+ * Take a wake lock without a timeout under its own lock only. Returns
+ * false if the lock currently has a timeout, in which case it sits on an
+ * expire tree and the caller has to fall back to the list_lock path.
+ */
+static bool wake_lock_fast(struct wake_lock *lock, int type)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&lock->lock, irqflags);
+	BUG_ON(!(lock->flags & WAKE_LOCK_INITIALIZED));
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
+		spin_unlock_irqrestore(&lock->lock, irqflags);
+		return false;
+	}
+#ifdef CONFIG_WAKELOCK_STAT
+	wake_lock_stat_locked(lock, type);
+#endif
+	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
+		lock->flags |= WAKE_LOCK_ACTIVE;
+		atomic_inc(&active_count[type]);
+	}
+	spin_unlock_irqrestore(&lock->lock, irqflags);
+
+	if (debug_mask & DEBUG_WAKE_LOCK)
+		pr_info("wake_lock: %s, type %d\n", lock->name, type);
+	if (type == WAKE_LOCK_SUSPEND)
+		atomic_inc(&current_event_num);
+	return true;
+}
+
 static void wake_lock_internal(
 	struct wake_lock *lock, long timeout, int has_timeout)
 {
@@ -556,30 +689,29 @@ static void wake_lock_internal(
 	unsigned long irqflags;
 	long expire_in;
 
-	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
+	if (!has_timeout && lock != &main_wake_lock &&
+	    wake_lock_fast(lock, type))
+		return;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	spin_lock(&lock->lock);
 	BUG_ON(!(lock->flags & WAKE_LOCK_INITIALIZED));
 #ifdef CONFIG_WAKELOCK_STAT
-	if (type == WAKE_LOCK_SUSPEND && wait_for_wakeup) {
-		if (debug_mask & DEBUG_WAKEUP)
-			pr_info("wakeup wake lock: %s\n", lock->name);
-		wait_for_wakeup = 0;
-		lock->stat.wakeup_count++;
-	}
 	if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) &&
 	    (long)(lock->expires - jiffies) <= 0) {
 		wake_unlock_stat_locked(lock, 0);
 		lock->stat.last_time = ktime_get();
 	}
+	wake_lock_stat_locked(lock, type);
 #endif
-	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
 		lock->flags |= WAKE_LOCK_ACTIVE;
-#ifdef CONFIG_WAKELOCK_STAT
-		lock->stat.last_time = ktime_get();
-#endif
-	}
-	list_del(&lock->link);
+	else if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		rb_erase(&lock->node, &expire_locks[type]);
+	else
+		atomic_dec(&active_count[type]);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
@@ -587,39 +719,26 @@ static void wake_lock_internal(
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
+		wake_lock_insert_expire_locked(lock, type);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
-		list_add(&lock->link, &active_wake_locks[type]);
+		atomic_inc(&active_count[type]);
 	}
+	spin_unlock(&lock->lock);
 	if (type == WAKE_LOCK_SUSPEND) {
-		current_event_num++;
+		atomic_inc(&current_event_num);
 #ifdef CONFIG_WAKELOCK_STAT
 		if (lock == &main_wake_lock)
 			update_sleep_wait_stats_locked(1);
-		else if (!wake_lock_active(&main_wake_lock))
-			update_sleep_wait_stats_locked(0);
 #endif
 		if (has_timeout)
 			expire_in = has_wake_lock_locked(type);
 		else
 			expire_in = -1;
-		if (expire_in > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_lock: %s, start expire timer, "
-					"%ld\n", lock->name, expire_in);
-			mod_timer(&expire_timer, jiffies + expire_in);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_lock: %s, stop expire timer\n",
-						lock->name);
-			if (expire_in == 0)
-				queue_work(suspend_work_queue, &suspend_work);
-		}
+		update_expire_timer_locked(lock, "wake_lock", expire_in);
 	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
@@ -636,35 +755,62 @@ void wake_lock_timeout(struct wake_lock *lock, long timeout)
 }
 EXPORT_SYMBOL(wake_lock_timeout);
 
+/*
+ * Release a wake lock without a timeout under its own lock only. list_lock
+ * is still taken when the last such suspend lock goes away, since the
+ * expire timer or suspend work may have to be started then.
+ */
+static bool wake_unlock_fast(struct wake_lock *lock, int type)
+{
+	unsigned long irqflags;
+	bool last = false;
+
+	spin_lock_irqsave(&lock->lock, irqflags);
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
+		spin_unlock_irqrestore(&lock->lock, irqflags);
+		return false;
+	}
+	if (lock->flags & WAKE_LOCK_ACTIVE) {
+#ifdef CONFIG_WAKELOCK_STAT
+		wake_unlock_stat_locked(lock, 0);
+#endif
+		lock->flags &= ~WAKE_LOCK_ACTIVE;
+		last = atomic_dec_and_test(&active_count[type]);
+	}
+	spin_unlock_irqrestore(&lock->lock, irqflags);
+
+	if (debug_mask & DEBUG_WAKE_LOCK)
+		pr_info("wake_unlock: %s\n", lock->name);
+	if (last && type == WAKE_LOCK_SUSPEND) {
+		spin_lock_irqsave(&list_lock, irqflags);
+		update_expire_timer_locked(lock, "wake_unlock",
+					   has_wake_lock_locked(type));
+		spin_unlock_irqrestore(&list_lock, irqflags);
+	}
+	return true;
+}
+
 void wake_unlock(struct wake_lock *lock)
 {
 	int type;
 	unsigned long irqflags;
-	spin_lock_irqsave(&list_lock, irqflags);
+
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
+	if (lock != &main_wake_lock && wake_unlock_fast(lock, type))
+		return;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	spin_lock(&lock->lock);
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 0);
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
-	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
+	wake_lock_deactivate_locked(lock, type);
+	spin_unlock(&lock->lock);
 	if (type == WAKE_LOCK_SUSPEND) {
-		long has_lock = has_wake_lock_locked(type);
-		if (has_lock > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_unlock: %s, start expire timer, "
-					"%ld\n", lock->name, has_lock);
-			mod_timer(&expire_timer, jiffies + has_lock);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_unlock: %s, stop expire "
-						"timer\n", lock->name);
-			if (has_lock == 0)
-				queue_work(suspend_work_queue, &suspend_work);
-		}
+		update_expire_timer_locked(lock, "wake_unlock",
+					   has_wake_lock_locked(type));
 		if (lock == &main_wake_lock) {
 			if (debug_mask & DEBUG_SUSPEND)
 				print_active_locks(WAKE_LOCK_SUSPEND);
@@ -708,10 +854,6 @@ static const struct file_operations wakelock_stats_fops = {
 static int __init wakelocks_init(void)
 {
 	int ret;
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
-		INIT_LIST_HEAD(&active_wake_locks[i]);
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
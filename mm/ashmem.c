@@ -27,7 +27,13 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/lzo.h>
+#include <linux/swap.h>
 #include <linux/ashmem.h>
 
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
@@ -37,12 +43,13 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `lock'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct mutex lock;		/* protects this area and its ranges */
+	struct rb_root unpinned;	/* unpinned ranges, sorted by pgstart */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
@@ -51,29 +58,40 @@ struct ashmem_area {
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `lock'; `lru' by `ashmem_lru_lock'
+ *
+ * The ranges of an area never overlap, so ordering them by pgstart also
+ * orders them by pgend and a plain rbtree serves as the interval tree.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+#ifdef CONFIG_ASHMEM_COMPRESS
+	struct ashmem_cpage **cpages;	/* compressed copy of a purged range */
+#endif
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count
+ *
+ * Lock Ordering: asma->lock -> i_mutex -> i_alloc_sem
+ *		  asma->lock -> ashmem_lru_lock
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * The shrinker walks the LRU under ashmem_lru_lock and only trylocks the
+ * owning area, so it never waits for pin/unpin on any area and never
+ * holds more than one area lock.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -104,29 +122,84 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *next = rb_next(&range->node);
+
+	return next ? rb_entry(next, struct ashmem_range, node) : NULL;
+}
+
+/*
+ * range_first - find the first unpinned range ending at or after 'pgstart'
+ *
+ * Returns NULL if there is none. Caller must hold asma->lock.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma,
+					size_t pgstart)
+{
+	struct rb_node *n = asma->unpinned.rb_node;
+	struct ashmem_range *first = NULL;
+
+	while (n) {
+		struct ashmem_range *range;
+
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range_before_page(range, pgstart)) {
+			n = n->rb_right;
+		} else {
+			first = range;
+			n = n->rb_left;
+		}
+	}
+
+	return first;
+}
+
+static void range_insert(struct ashmem_area *asma, struct ashmem_range *range)
+{
+	struct rb_node **p = &asma->unpinned.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct ashmem_range *entry;
+
+		parent = *p;
+		entry = rb_entry(parent, struct ashmem_range, node);
+		if (range->pgstart < entry->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned);
 }
 
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
 	struct ashmem_range *range;
@@ -140,7 +213,7 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	range_insert(asma, range);
 
 	if (range_on_lru(range))
 		lru_add(range);
@@ -148,18 +221,21 @@ static int range_alloc(struct ashmem_area *asma,
 	return 0;
 }
 
+static void range_drop_compressed(struct ashmem_range *range);
+
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
+	rb_erase(&range->node, &range->asma->unpinned);
 	if (range_on_lru(range))
 		lru_del(range);
+	range_drop_compressed(range);
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -169,8 +245,11 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -186,7 +265,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->lock);
+	asma->unpinned = RB_ROOT;
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -197,12 +277,12 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *n;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
+	while ((n = rb_first(&asma->unpinned)) != NULL)
+		range_del(rb_entry(n, struct ashmem_range, node));
+	mutex_unlock(&asma->lock);
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +297,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +318,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -247,7 +327,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +348,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -285,7 +365,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +408,360 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
+#ifdef CONFIG_ASHMEM_COMPRESS
+/*
+ * Compressed purge tier
+ *
+ * Instead of discarding an unpinned range outright, the shrinker first
+ * compresses its pages with LZO into kmalloc'ed buffers and only then
+ * truncates the backing file. Such a range counts as purged (its pages are
+ * gone from shmem), but keeps the compressed copy in `cpages' and sits on
+ * `ashmem_compressed_list' instead of the LRU. Pinning it decompresses the
+ * data back into the file and ASHMEM_PIN reports ASHMEM_WAS_RESTORED.
+ *
+ * The compressed pool is bounded by `compress_pool_max' and has a shrinker
+ * of its own; either way its oldest ranges are dropped first, at which
+ * point they become ordinary purged ranges.
+ */
+struct ashmem_cpage {
+	size_t len;
+	unsigned char data[];
+};
+
+static bool compress = true;
+module_param(compress, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(compress, "compress unpinned ranges before purging them");
+
+/* LRU list of compressed ranges, protected by ashmem_lru_lock */
+static LIST_HEAD(ashmem_compressed_list);
+
+/* Bytes held by the compressed pool, protected by ashmem_lru_lock */
+static unsigned long compress_pool_size;
+
+/* Upper bound of the compressed pool in bytes, defaults to 1/16 of RAM */
+static unsigned long compress_pool_max;
+
+/* Serializes use of the compression buffers below */
+static DEFINE_MUTEX(ashmem_compress_mutex);
+static void *ashmem_compress_wrkmem;
+static unsigned char *ashmem_compress_buf;
+
+#define range_compressed(range) ((range)->cpages != NULL)
+
+static size_t cpages_size(struct ashmem_cpage **cpages, size_t nr)
+{
+	size_t i, size = 0;
+
+	for (i = 0; i < nr; i++)
+		size += cpages[i]->len;
+
+	return size;
+}
+
+static void cpages_free(struct ashmem_cpage **cpages, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		kfree(cpages[i]);
+	kfree(cpages);
+}
+
+/*
+ * range_drop_compressed - throw away the compressed copy of a range, if any
+ *
+ * The range stays purged. Caller must hold asma->lock.
+ */
+static void range_drop_compressed(struct ashmem_range *range)
+{
+	size_t nr = range_size(range);
+
+	if (!range_compressed(range))
+		return;
+
+	spin_lock(&ashmem_lru_lock);
+	list_del(&range->lru);
+	compress_pool_size -= cpages_size(range->cpages, nr);
+	spin_unlock(&ashmem_lru_lock);
+
+	cpages_free(range->cpages, nr);
+	range->cpages = NULL;
+}
+
+/*
+ * range_compress - compress the pages of an unpinned range
+ *
+ * Returns the compressed copy, or NULL if a page is not resident, the data
+ * does not compress to at most 3/4 of its size, memory is short or a page
+ * is locked, in which case the range is simply purged. Called from reclaim, so nothing
+ * in here may wait for memory. Caller must hold asma->lock.
+ */
+static struct ashmem_cpage **range_compress(struct ashmem_range *range)
+{
+	const gfp_t gfp = GFP_NOWAIT | __GFP_NOWARN | __GFP_NOMEMALLOC;
+	struct address_space *mapping = range->asma->file->f_mapping;
+	size_t nr = range_size(range);
+	struct ashmem_cpage **cpages;
+	size_t i, total = 0;
+
+	cpages = kcalloc(nr, sizeof(*cpages), gfp);
+	if (!cpages)
+		return NULL;
+
+	mutex_lock(&ashmem_compress_mutex);
+	for (i = 0; i < nr; i++) {
+		struct page *page;
+		size_t len;
+		void *src;
+		int ret;
+
+		page = find_get_page(mapping, range->pgstart + i);
+		if (!page)
+			break;
+		if (!trylock_page(page)) {
+			page_cache_release(page);
+			break;
+		}
+		if (!PageUptodate(page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			break;
+		}
+		src = kmap_atomic(page, KM_USER0);
+		ret = lzo1x_1_compress(src, PAGE_SIZE, ashmem_compress_buf,
+				       &len, ashmem_compress_wrkmem);
+		kunmap_atomic(src, KM_USER0);
+		unlock_page(page);
+		page_cache_release(page);
+
+		total += len;
+		if (ret != LZO_E_OK || total > nr * PAGE_SIZE / 4 * 3)
+			break;
+
+		cpages[i] = kmalloc(sizeof(struct ashmem_cpage) + len, gfp);
+		if (!cpages[i])
+			break;
+		cpages[i]->len = len;
+		memcpy(cpages[i]->data, ashmem_compress_buf, len);
+	}
+	mutex_unlock(&ashmem_compress_mutex);
+
+	if (i < nr) {
+		cpages_free(cpages, i);
+		return NULL;
+	}
+
+	return cpages;
+}
+
+/*
+ * range_restore - decompress a compressed range back into its backing file
+ *
+ * Returns ASHMEM_WAS_RESTORED and puts the range back on the LRU as an
+ * ordinary unpinned range, or ASHMEM_WAS_PURGED if the data could not be
+ * brought back. Caller must hold asma->lock.
+ */
+static int range_restore(struct ashmem_range *range)
+{
+	struct file *file = range->asma->file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct ashmem_cpage **cpages = range->cpages;
+	size_t nr = range_size(range);
+	int ret = ASHMEM_WAS_RESTORED;
+	size_t i;
+
+	spin_lock(&ashmem_lru_lock);
+	list_del(&range->lru);
+	compress_pool_size -= cpages_size(cpages, nr);
+	spin_unlock(&ashmem_lru_lock);
+
+	mutex_lock(&inode->i_mutex);
+	for (i = 0; i < nr; i++) {
+		loff_t pos = (loff_t)(range->pgstart + i) << PAGE_SHIFT;
+		size_t len = PAGE_SIZE;
+		struct page *page;
+		void *fsdata;
+		void *dst;
+		int err;
+
+		if (pagecache_write_begin(file, mapping, pos, PAGE_SIZE, 0,
+					  &page, &fsdata)) {
+			ret = ASHMEM_WAS_PURGED;
+			break;
+		}
+		dst = kmap_atomic(page, KM_USER0);
+		err = lzo1x_decompress_safe(cpages[i]->data, cpages[i]->len,
+					    dst, &len);
+		if (err != LZO_E_OK || len != PAGE_SIZE) {
+			memset(dst, 0, PAGE_SIZE);
+			ret = ASHMEM_WAS_PURGED;
+		}
+		kunmap_atomic(dst, KM_USER0);
+		flush_dcache_page(page);
+		pagecache_write_end(file, mapping, pos, PAGE_SIZE, PAGE_SIZE,
+				    page, fsdata);
+		if (ret != ASHMEM_WAS_RESTORED)
+			break;
+	}
+	mutex_unlock(&inode->i_mutex);
+
+	cpages_free(cpages, nr);
+	range->cpages = NULL;
+
+	if (ret != ASHMEM_WAS_RESTORED) {
+		vmtruncate_range(inode, (loff_t)range->pgstart << PAGE_SHIFT,
+				 ((loff_t)(range->pgend + 1) << PAGE_SHIFT) - 1);
+		return ret;
+	}
+
+	range->purged = ASHMEM_NOT_PURGED;
+	lru_add(range);
+
+	return ret;
+}
+
+/*
+ * ashmem_compressed_evict - drop the oldest compressed ranges until the
+ * pool is at most 'target' bytes large. Busy areas are skipped.
+ */
+static void ashmem_compressed_evict(unsigned long target)
+{
+	while (compress_pool_size > target) {
+		struct ashmem_range *range = NULL, *r;
+		struct ashmem_area *asma;
+
+		spin_lock(&ashmem_lru_lock);
+		list_for_each_entry(r, &ashmem_compressed_list, lru) {
+			if (mutex_trylock(&r->asma->lock)) {
+				range = r;
+				break;
+			}
+		}
+		spin_unlock(&ashmem_lru_lock);
+		if (!range)
+			break;
+
+		asma = range->asma;
+		range_drop_compressed(range);
+		mutex_unlock(&asma->lock);
+	}
+}
+
+/*
+ * ashmem_purge_range - purge an unpinned range, keeping a compressed copy
+ * if possible. Caller must hold asma->lock.
+ */
+static void ashmem_purge_range(struct ashmem_range *range)
+{
+	struct inode *inode = range->asma->file->f_dentry->d_inode;
+	loff_t start = range->pgstart * PAGE_SIZE;
+	loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	struct ashmem_cpage **cpages = NULL;
+
+	if (compress)
+		cpages = range_compress(range);
+
+	vmtruncate_range(inode, start, end);
+	range->purged = ASHMEM_WAS_PURGED;
+	lru_del(range);
+
+	if (cpages) {
+		range->cpages = cpages;
+		spin_lock(&ashmem_lru_lock);
+		list_add_tail(&range->lru, &ashmem_compressed_list);
+		compress_pool_size += cpages_size(cpages, range_size(range));
+		spin_unlock(&ashmem_lru_lock);
+	}
+}
+
+/*
+ * ashmem_compressed_shrink - shrinker of the compressed pool, in units of
+ * pages worth of compressed data
+ */
+static int ashmem_compressed_shrink(struct shrinker *s,
+				    struct shrink_control *sc)
+{
+	unsigned long size = compress_pool_size;
+
+	if (sc->nr_to_scan) {
+		unsigned long nr = sc->nr_to_scan << PAGE_SHIFT;
+
+		ashmem_compressed_evict(size > nr ? size - nr : 0);
+	}
+
+	return compress_pool_size >> PAGE_SHIFT;
+}
+
+static struct shrinker ashmem_compressed_shrinker = {
+	.shrink = ashmem_compressed_shrink,
+	.seeks = DEFAULT_SEEKS * 8,
+};
+
+static int __init ashmem_compress_init(void)
+{
+	ashmem_compress_wrkmem = kmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+	ashmem_compress_buf = kmalloc(lzo1x_worst_compress(PAGE_SIZE),
+				      GFP_KERNEL);
+	if (!ashmem_compress_wrkmem || !ashmem_compress_buf) {
+		kfree(ashmem_compress_wrkmem);
+		kfree(ashmem_compress_buf);
+		return -ENOMEM;
+	}
+
+	compress_pool_max = (totalram_pages >> 4) << PAGE_SHIFT;
+	register_shrinker(&ashmem_compressed_shrinker);
+
+	return 0;
+}
+
+static void ashmem_compress_exit(void)
+{
+	unregister_shrinker(&ashmem_compressed_shrinker);
+	kfree(ashmem_compress_wrkmem);
+	kfree(ashmem_compress_buf);
+}
+#else
+#define range_compressed(range) 0
+
+static inline void range_drop_compressed(struct ashmem_range *range)
+{
+}
+
+static inline int range_restore(struct ashmem_range *range)
+{
+	return ASHMEM_WAS_PURGED;
+}
+
+static inline void ashmem_compressed_evict(unsigned long target)
+{
+}
+
+static void ashmem_purge_range(struct ashmem_range *range)
+{
+	struct inode *inode = range->asma->file->f_dentry->d_inode;
+	loff_t start = range->pgstart * PAGE_SIZE;
+	loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+	vmtruncate_range(inode, start, end);
+	range->purged = ASHMEM_WAS_PURGED;
+	lru_del(range);
+}
+
+static inline int ashmem_compress_init(void)
+{
+	return 0;
+}
+
+static inline void ashmem_compress_exit(void)
+{
+}
+#endif /* CONFIG_ASHMEM_COMPRESS */
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -345,11 +775,11 @@ out:
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * pages freed. Ranges whose area is busy are skipped rather than waited for.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
@@ -357,21 +787,36 @@ static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	while (sc->nr_to_scan > 0) {
+		struct ashmem_range *r;
+		struct ashmem_area *asma;
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+		/*
+		 * A range on the LRU keeps its area alive for as long as we
+		 * hold ashmem_lru_lock, and once we own the area's lock the
+		 * range cannot be pinned or freed under us.
+		 */
+		range = NULL;
+		spin_lock(&ashmem_lru_lock);
+		list_for_each_entry(r, &ashmem_lru_list, lru) {
+			if (mutex_trylock(&r->asma->lock)) {
+				range = r;
+				break;
+			}
+		}
+		spin_unlock(&ashmem_lru_lock);
+		if (!range)
+			break;
+
+		asma = range->asma;
+		ashmem_purge_range(range);
 
 		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		mutex_unlock(&asma->lock);
 	}
-	mutex_unlock(&ashmem_mutex);
+#ifdef CONFIG_ASHMEM_COMPRESS
+	ashmem_compressed_evict(compress_pool_max);
+#endif
 
 	return lru_count;
 }
@@ -385,7 +830,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +845,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -408,7 +853,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +867,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -431,7 +876,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,25 +893,28 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
 
 /*
  * ashmem_pin - pin the given ashmem region, returning whether it was
- * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
+ * previously purged (ASHMEM_WAS_PURGED), purged but restored from the
+ * compressed pool (ASHMEM_WAS_RESTORED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
+	for (range = range_first(asma, pgstart); range; range = next) {
+		next = range_next(range);
+
 		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
+		if (range->pgstart > pgend)
 			break;
 
 		/*
@@ -485,6 +933,8 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    create a new range for the other side.
 		 */
 		if (page_range_in_range(range, pgstart, pgend)) {
+			if (range_compressed(range))
+				ret |= range_restore(range);
 			ret |= range->purged;
 
 			/* Case #1: Easy. Just nuke the whole thing. */
@@ -510,30 +960,35 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			 * more complicated, we allocate a new range for the
 			 * second half and adjust the first chunk's endpoint.
 			 */
-			range_alloc(asma, range, range->purged,
+			range_alloc(asma, range->purged,
 				    pgend + 1, range->pgend);
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
 	}
 
+	/* any lost page means the caller has to regenerate the data */
+	if (ret & ASHMEM_WAS_PURGED)
+		ret = ASHMEM_WAS_PURGED;
+
 	return ret;
 }
 
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
+	for (range = range_first(asma, pgstart); range; range = next) {
+		next = range_next(range);
+
+		/* short circuit: no further range can overlap */
+		if (range->pgstart > pgend)
 			break;
 
 		/*
@@ -547,35 +1002,28 @@ restart:
 			pgend = max_t(size_t, range->pgend, pgend);
 			purged |= range->purged;
 			range_del(range);
-			goto restart;
 		}
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
 	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
 
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	range = range_first(asma, pgstart);
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
 
-	return ret;
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -607,7 +1055,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -621,7 +1069,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -719,6 +1167,13 @@ static int __init ashmem_init(void)
 		return ret;
 	}
 
+	ret = ashmem_compress_init();
+	if (unlikely(ret)) {
+		printk(KERN_ERR "ashmem: failed to set up compression!\n");
+		misc_deregister(&ashmem_misc);
+		return ret;
+	}
+
 	register_shrinker(&ashmem_shrinker);
 
 	printk(KERN_INFO "ashmem: initialized\n");
@@ -731,6 +1186,7 @@ static void __exit ashmem_exit(void)
 	int ret;
 
 	unregister_shrinker(&ashmem_shrinker);
+	ashmem_compress_exit();
 
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
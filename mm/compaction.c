@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/ktime.h>
 #include "internal.h"
 
 #if defined CONFIG_COMPACTION || defined CONFIG_CMA
@@ -333,6 +336,10 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 #endif /* CONFIG_COMPACTION || CONFIG_CMA */
 #ifdef CONFIG_COMPACTION
 
+/* Pageblocks kcompactd scans in a zone per pass, and the break in between */
+#define KCOMPACTD_SLICE_BLOCKS		32
+#define KCOMPACTD_SLICE_INTERVAL	(HZ / 10)
+
 /* Returns true if the page is within a block suitable for migration to */
 static bool suitable_migration_target(struct page *page)
 {
@@ -548,6 +555,10 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
+	/* kcompactd works through a zone a slice at a time */
+	if (cc->kcompactd && cc->migrate_pfn >= cc->end_migrate_pfn)
+		return COMPACT_PARTIAL;
+
 	/* Compaction run is not finished if the watermark is not met */
 	watermark = low_wmark_pages(zone);
 	watermark += (1 << cc->order);
@@ -639,6 +650,20 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 	cc->free_pfn = cc->migrate_pfn + zone->spanned_pages;
 	cc->free_pfn &= ~(pageblock_nr_pages-1);
 
+	/* kcompactd picks up where its last pass left off */
+	if (cc->kcompactd) {
+		unsigned long migrate_pfn = zone->compact_cached_migrate_pfn;
+		unsigned long free_pfn = zone->compact_cached_free_pfn;
+
+		if (migrate_pfn > cc->migrate_pfn && free_pfn <= cc->free_pfn &&
+		    migrate_pfn < free_pfn) {
+			cc->migrate_pfn = migrate_pfn;
+			cc->free_pfn = free_pfn;
+		}
+		cc->end_migrate_pfn = cc->migrate_pfn +
+			KCOMPACTD_SLICE_BLOCKS * pageblock_nr_pages;
+	}
+
 	migrate_prep_local();
 
 	while ((ret = compact_finished(zone, cc)) == COMPACT_CONTINUE) {
@@ -686,6 +711,16 @@ out:
 	cc->nr_freepages -= release_freepages(&cc->freepages);
 	VM_BUG_ON(cc->nr_freepages != 0);
 
+	if (cc->kcompactd) {
+		if (ret == COMPACT_COMPLETE) {
+			zone->compact_cached_migrate_pfn = 0;
+			zone->compact_cached_free_pfn = 0;
+		} else {
+			zone->compact_cached_migrate_pfn = cc->migrate_pfn;
+			zone->compact_cached_free_pfn = cc->free_pfn;
+		}
+	}
+
 	return ret;
 }
 
@@ -737,6 +772,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	struct zoneref *z;
 	struct zone *zone;
 	int rc = COMPACT_SKIPPED;
+	ktime_t start;
 
 	/*
 	 * Check whether it is worth even starting compaction. The order check is
@@ -747,6 +783,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 		return rc;
 
 	count_vm_event(COMPACTSTALL);
+	start = ktime_get();
 
 	/* Compact each zone in the list */
 	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
@@ -761,6 +798,8 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			break;
 	}
 
+	count_vm_events(COMPACTSTALL_US, ktime_us_delta(ktime_get(), start));
+
 	return rc;
 }
 
@@ -835,6 +874,228 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * kcompactd - background compaction
+ *
+ * Direct compaction makes the allocating task wait for a whole zone to be
+ * compacted. To keep high-order pages for ion and network buffers around
+ * before anybody has to stall for them, every node runs a kcompactd
+ * thread. High-order allocations entering the slow path, and kswapd once
+ * it has reclaimed for a high order, wake it up if the fragmentation
+ * index of a zone shows that the order is short because of fragmentation
+ * rather than lack of memory (see sysctl_extfrag_threshold).
+ *
+ * kcompactd migrates asynchronously and only KCOMPACTD_SLICE_BLOCKS
+ * pageblocks per zone in one pass, carrying on from where it stopped
+ * after a short break, until a page of the order is free or the zone has
+ * been gone through. Zones that could not be helped are deferred like
+ * they are for direct compaction.
+ */
+static bool kcompactd_node_suitable(pg_data_t *pgdat, int order,
+				    int classzone_idx)
+{
+	int zoneid;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, order) == COMPACT_CONTINUE)
+			return true;
+	}
+
+	return false;
+}
+
+static bool kcompactd_work_requested(pg_data_t *pgdat)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+/*
+ * Compact one slice of each zone that needs it. Returns true if a zone
+ * still needs more work, so kcompactd should come back after a break.
+ */
+static bool kcompactd_do_work(pg_data_t *pgdat)
+{
+	int order, classzone_idx;
+	bool more = false;
+	unsigned long flags;
+	ktime_t start;
+	int zoneid;
+
+	spin_lock_irqsave(&pgdat->kcompactd_lock, flags);
+	order = pgdat->kcompactd_max_order;
+	classzone_idx = pgdat->kcompactd_classzone_idx;
+	spin_unlock_irqrestore(&pgdat->kcompactd_lock, flags);
+
+	count_vm_event(KCOMPACTD_WAKE);
+	start = ktime_get();
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.zone = zone,
+			.sync = false,
+			.kcompactd = true,
+		};
+		int status;
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_deferred(zone))
+			continue;
+
+		if (compaction_suitable(zone, order) != COMPACT_CONTINUE)
+			continue;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		status = compact_zone(zone, &cc);
+
+		if (zone_watermark_ok(zone, order, low_wmark_pages(zone), 0, 0)) {
+			zone->compact_considered = 0;
+			zone->compact_defer_shift = 0;
+		} else if (status == COMPACT_COMPLETE) {
+			defer_compaction(zone);
+		} else {
+			more = true;
+		}
+
+		if (kthread_should_stop())
+			break;
+	}
+
+	count_vm_events(KCOMPACTD_US, ktime_us_delta(ktime_get(), start));
+
+	/* Done with this request unless a bigger one came in meanwhile */
+	if (!more) {
+		spin_lock_irqsave(&pgdat->kcompactd_lock, flags);
+		if (pgdat->kcompactd_max_order <= order)
+			pgdat->kcompactd_max_order = 0;
+		if (pgdat->kcompactd_classzone_idx >= classzone_idx)
+			pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+		spin_unlock_irqrestore(&pgdat->kcompactd_lock, flags);
+	}
+
+	return more;
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+	bool more = false;
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	spin_lock_irq(&pgdat->kcompactd_lock);
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+	spin_unlock_irq(&pgdat->kcompactd_lock);
+
+	while (!kthread_should_stop()) {
+		if (more)
+			schedule_timeout_interruptible(KCOMPACTD_SLICE_INTERVAL);
+		else
+			wait_event_freezable(pgdat->kcompactd_wait,
+					     kcompactd_work_requested(pgdat));
+
+		try_to_freeze();
+		if (kthread_should_stop())
+			break;
+
+		more = kcompactd_do_work(pgdat);
+	}
+
+	return 0;
+}
+
+/**
+ * wakeup_kcompactd - ask for background compaction of a node
+ * @pgdat: the node to compact
+ * @order: the order that should become available
+ * @classzone_idx: the highest zone that may be used
+ *
+ * kcompactd is only woken if a zone is short of @order pages because of
+ * fragmentation.
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	unsigned long flags;
+
+	if (!order || !pgdat->kcompactd)
+		return;
+
+	if (!kcompactd_node_suitable(pgdat, order, classzone_idx))
+		return;
+
+	/* Atomic allocations get here too, possibly from interrupts */
+	spin_lock_irqsave(&pgdat->kcompactd_lock, flags);
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+	spin_unlock_irqrestore(&pgdat->kcompactd_lock, flags);
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		pr_err("Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
@@ -12,6 +12,7 @@
 #define __MM_INTERNAL_H
 
 #include <linux/mm.h>
+#include <linux/sched.h>
 
 void free_pgtables(struct mmu_gather *tlb, struct vm_area_struct *start_vma,
 		unsigned long floor, unsigned long ceiling);
@@ -85,12 +86,6 @@ static inline void get_page_foll(struct page *page)
 
 extern unsigned long highest_memmap_pfn;
 
-/*
- * in mm/vmscan.c:
- */
-extern int isolate_lru_page(struct page *page);
-extern void putback_lru_page(struct page *page);
-
 /*
  * in mm/page_alloc.c
  */
@@ -124,6 +119,9 @@ struct compact_control {
 	int order;			/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
 	struct zone *zone;
+
+	bool kcompactd;			/* Background compaction by kcompactd */
+	unsigned long end_migrate_pfn;	/* kcompactd: stop this pass here */
 };
 
 unsigned long
@@ -333,6 +331,29 @@ static inline void mminit_validate_memmodel_limits(unsigned long *start_pfn,
 #define ZONE_RECLAIM_FULL	-1
 #define ZONE_RECLAIM_SOME	0
 #define ZONE_RECLAIM_SUCCESS	1
+
+/*
+ * zone->lru_lock hold times, counted in /proc/vmstat: take a timestamp
+ * with lru_lock_clock() once the lock is taken and pass it to
+ * lru_lock_account() just before dropping it, interrupts still disabled.
+ */
+#ifdef CONFIG_VM_EVENT_COUNTERS
+static inline u64 lru_lock_clock(void)
+{
+	return sched_clock();
+}
+
+extern void lru_lock_account(u64 start);
+#else
+static inline u64 lru_lock_clock(void)
+{
+	return 0;
+}
+
+static inline void lru_lock_account(u64 start)
+{
+}
+#endif
 #endif
 
 extern int hwpoison_filter(struct page *p);
@@ -38,6 +38,73 @@ int sysctl_oom_kill_allocating_task;
 int sysctl_oom_dump_tasks = 1;
 static DEFINE_SPINLOCK(zone_scan_lock);
 
+#ifdef CONFIG_OOM_ADJ_INDEX
+DEFINE_SPINLOCK(oom_adj_index_lock);
+struct list_head oom_adj_index[OOM_ADJ_INDEX_SIZE];
+
+static int __init oom_adj_index_init(void)
+{
+	int i;
+
+	for (i = 0; i < OOM_ADJ_INDEX_SIZE; i++)
+		INIT_LIST_HEAD(&oom_adj_index[i]);
+	return 0;
+}
+pure_initcall(oom_adj_index_init);
+
+/*
+ * Called with tasklist_lock write-locked when 'p' becomes a new thread
+ * group leader in copy_process().
+ */
+void oom_adj_index_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	list_add_tail(&p->oom_adj_node,
+		      oom_adj_index_bucket(p->signal->oom_adj));
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+/* Called with tasklist_lock write-locked when the group is unhashed */
+void oom_adj_index_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	list_del_init(&p->oom_adj_node);
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+/* Called with tasklist_lock write-locked when de_thread() swaps leaders */
+void oom_adj_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	if (!list_empty(&old->oom_adj_node))
+		list_replace_init(&old->oom_adj_node, &new->oom_adj_node);
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+/*
+ * Refile the thread group of 'p' after its oom_adj changed. Must not be
+ * called under task_lock() or the sighand lock.
+ */
+void oom_adj_index_update(struct task_struct *p)
+{
+	struct task_struct *leader;
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	leader = p->group_leader;
+	if (!list_empty(&leader->oom_adj_node))
+		list_move_tail(&leader->oom_adj_node,
+			       oom_adj_index_bucket(p->signal->oom_adj));
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+#endif
+
 /**
  * test_set_oom_score_adj() - set current's oom_score_adj and return old value
  * @new_val: new oom_score_adj value
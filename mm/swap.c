@@ -37,10 +37,31 @@
 /* How many pages do we try to swap or page in/out together? */
 int page_cluster;
 
-static DEFINE_PER_CPU(struct pagevec[NR_LRU_LISTS], lru_add_pvecs);
-static DEFINE_PER_CPU(struct pagevec, lru_rotate_pvecs);
+/*
+ * Pages are added to the LRU and rotated to its tail in per-cpu batches,
+ * so that zone->lru_lock is taken once per batch rather than per page.
+ * A batch starts out at PAGEVEC_SIZE pages and doubles, up to
+ * LRU_BATCH_MAX, whenever the lock was contended when it was flushed;
+ * uncontended flushes shrink it back by a page at a time. Pages sitting
+ * in a batch are invisible to reclaim, so while memory is short all
+ * batches fall back to PAGEVEC_SIZE, draining on their next addition.
+ */
+#define LRU_BATCH_MAX	64
+
+struct lru_batch {
+	unsigned int nr;
+	unsigned int limit;	/* 0 until first flushed: PAGEVEC_SIZE */
+	struct page *pages[LRU_BATCH_MAX];
+};
+
+static DEFINE_PER_CPU(struct lru_batch[NR_LRU_LISTS], lru_add_batches);
+static DEFINE_PER_CPU(struct lru_batch, lru_rotate_batch);
 static DEFINE_PER_CPU(struct pagevec, lru_deactivate_pvecs);
 
+static unsigned long lru_batch_pressure_until = INITIAL_JIFFIES;
+
+static void ____pagevec_lru_add_fn(struct page *page, void *arg);
+
 /*
  * This path almost never happens for VM activity - pages are normally
  * freed via pagevecs.  But it gets used by networking.
@@ -202,33 +223,143 @@ void put_pages_list(struct list_head *pages)
 }
 EXPORT_SYMBOL(put_pages_list);
 
-static void pagevec_lru_move_fn(struct pagevec *pvec,
-				void (*move_fn)(struct page *page, void *arg),
-				void *arg)
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/* Nanoseconds of lru_lock hold time not yet counted as a whole microsecond */
+static DEFINE_PER_CPU(unsigned long, lru_lock_hold_ns);
+
+/*
+ * Counted in microseconds, as nanoseconds would wrap a 32-bit counter in
+ * seconds. Short holds are carried over per cpu rather than rounded away.
+ */
+void lru_lock_account(u64 start)
+{
+	unsigned long ns;
+
+	ns = __this_cpu_read(lru_lock_hold_ns) +
+	     (unsigned long)(lru_lock_clock() - start);
+	__count_vm_events(LRU_LOCK_HOLD_US, ns / NSEC_PER_USEC);
+	__this_cpu_write(lru_lock_hold_ns, ns % NSEC_PER_USEC);
+}
+#endif
+
+/*
+ * Take zone->lru_lock for a batch of pages. Returns true if the lock had
+ * to be waited for. The acquisition, any contention and, on unlock, the
+ * time the lock was held are counted in /proc/vmstat.
+ */
+static bool lru_batch_lock(struct zone *zone, unsigned long *flags,
+			   u64 *start)
+{
+	bool contended = false;
+
+	if (!spin_trylock_irqsave(&zone->lru_lock, *flags)) {
+		spin_lock_irqsave(&zone->lru_lock, *flags);
+		__count_vm_event(LRU_LOCK_CONTENDED);
+		contended = true;
+	}
+	__count_vm_event(LRU_LOCK_BATCHES);
+	*start = lru_lock_clock();
+
+	return contended;
+}
+
+static void lru_batch_unlock(struct zone *zone, unsigned long flags,
+			     u64 start)
+{
+	lru_lock_account(start);
+	spin_unlock_irqrestore(&zone->lru_lock, flags);
+}
+
+static bool lru_move_pages(struct page **pages, int nr,
+			   void (*move_fn)(struct page *page, void *arg),
+			   void *arg)
 {
 	int i;
 	struct zone *zone = NULL;
 	unsigned long flags = 0;
+	bool contended = false;
+	u64 start = 0;
 
-	for (i = 0; i < pagevec_count(pvec); i++) {
-		struct page *page = pvec->pages[i];
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
 		struct zone *pagezone = page_zone(page);
 
 		if (pagezone != zone) {
 			if (zone)
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
+				lru_batch_unlock(zone, flags, start);
 			zone = pagezone;
-			spin_lock_irqsave(&zone->lru_lock, flags);
+			contended |= lru_batch_lock(zone, &flags, &start);
 		}
 
 		(*move_fn)(page, arg);
 	}
 	if (zone)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		lru_batch_unlock(zone, flags, start);
+
+	return contended;
+}
+
+static void pagevec_lru_move_fn(struct pagevec *pvec,
+				void (*move_fn)(struct page *page, void *arg),
+				void *arg)
+{
+	lru_move_pages(pvec->pages, pagevec_count(pvec), move_fn, arg);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
 }
 
+static void lru_add_drain_all_fn(struct work_struct *work)
+{
+	lru_add_drain_all();
+}
+
+static DECLARE_WORK(lru_drain_work, lru_add_drain_all_fn);
+
+/**
+ * lru_add_pressure - shrink the per-cpu LRU batches for a while
+ *
+ * Called by reclaim when memory is short, so that pages do not linger
+ * in the per-cpu batches where reclaim cannot find them. The batches
+ * already filled beyond the new limit are drained once as the pressure
+ * starts; that waits for every cpu, so it is left to a work item.
+ */
+void lru_add_pressure(void)
+{
+	unsigned long old = ACCESS_ONCE(lru_batch_pressure_until);
+	unsigned long until = jiffies + HZ;
+
+	/* Write the shared line at most once a tick */
+	if (old == until)
+		return;
+	lru_batch_pressure_until = until;
+
+	if (!time_before(jiffies, old))
+		schedule_work(&lru_drain_work);
+}
+
+static inline unsigned int lru_batch_limit(struct lru_batch *batch)
+{
+	if (time_before(jiffies, ACCESS_ONCE(lru_batch_pressure_until)))
+		return PAGEVEC_SIZE;
+	return batch->limit ?: PAGEVEC_SIZE;
+}
+
+static void lru_batch_flush(struct lru_batch *batch,
+			    void (*move_fn)(struct page *page, void *arg),
+			    void *arg)
+{
+	unsigned int limit = batch->limit ?: PAGEVEC_SIZE;
+
+	if (lru_move_pages(batch->pages, batch->nr, move_fn, arg))
+		limit = min_t(unsigned int, limit * 2, LRU_BATCH_MAX);
+	else if (limit > PAGEVEC_SIZE)
+		limit--;
+	batch->limit = limit;
+
+	release_pages(batch->pages, batch->nr, 0);
+	batch->nr = 0;
+}
+
 static void pagevec_move_tail_fn(struct page *page, void *arg)
 {
 	int *pgmoved = arg;
@@ -236,21 +367,24 @@ static void pagevec_move_tail_fn(struct page *page, void *arg)
 
 	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
 		enum lru_list lru = page_lru_base_type(page);
-		list_move_tail(&page->lru, &zone->lru[lru].list);
-		mem_cgroup_rotate_reclaimable_page(page);
+
+		if (!lru_gen_rotate_page(zone, page)) {
+			list_move_tail(&page->lru, &zone->lru[lru].list);
+			mem_cgroup_rotate_reclaimable_page(page);
+		}
 		(*pgmoved)++;
 	}
 }
 
 /*
- * pagevec_move_tail() must be called with IRQ disabled.
+ * lru_rotate_flush() must be called with IRQ disabled.
  * Otherwise this may cause nasty races.
  */
-static void pagevec_move_tail(struct pagevec *pvec)
+static void lru_rotate_flush(struct lru_batch *batch)
 {
 	int pgmoved = 0;
 
-	pagevec_lru_move_fn(pvec, pagevec_move_tail_fn, &pgmoved);
+	lru_batch_flush(batch, pagevec_move_tail_fn, &pgmoved);
 	__count_vm_events(PGROTATED, pgmoved);
 }
 
@@ -263,14 +397,15 @@ void rotate_reclaimable_page(struct page *page)
 {
 	if (!PageLocked(page) && !PageDirty(page) && !PageActive(page) &&
 	    !PageUnevictable(page) && PageLRU(page)) {
-		struct pagevec *pvec;
+		struct lru_batch *batch;
 		unsigned long flags;
 
 		page_cache_get(page);
 		local_irq_save(flags);
-		pvec = &__get_cpu_var(lru_rotate_pvecs);
-		if (!pagevec_add(pvec, page))
-			pagevec_move_tail(pvec);
+		batch = &__get_cpu_var(lru_rotate_batch);
+		batch->pages[batch->nr++] = page;
+		if (batch->nr >= lru_batch_limit(batch))
+			lru_rotate_flush(batch);
 		local_irq_restore(flags);
 	}
 }
@@ -299,7 +434,7 @@ static void __activate_page(struct page *page, void *arg)
 {
 	struct zone *zone = page_zone(page);
 
-	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+	if (PageLRU(page) && !page_lru_active(page) && !PageUnevictable(page)) {
 		int file = page_is_file_cache(page);
 		int lru = page_lru_base_type(page);
 		del_page_from_lru_list(zone, page, lru);
@@ -360,10 +495,11 @@ void activate_page(struct page *page)
  */
 void mark_page_accessed(struct page *page)
 {
-	if (!PageActive(page) && !PageUnevictable(page) &&
+	if (!page_lru_active(page) && !PageUnevictable(page) &&
 			PageReferenced(page) && PageLRU(page)) {
 		activate_page(page);
 		ClearPageReferenced(page);
+		workingset_activation(page);
 	} else if (!PageReferenced(page)) {
 		SetPageReferenced(page);
 	}
@@ -373,27 +509,25 @@ EXPORT_SYMBOL(mark_page_accessed);
 
 void __lru_cache_add(struct page *page, enum lru_list lru)
 {
+	struct lru_batch *batch;
 #ifndef CONFIG_CMA
-	struct pagevec *pvec = &get_cpu_var(lru_add_pvecs)[lru];
-
-	page_cache_get(page);
-	if (!pagevec_add(pvec, page))
-		____pagevec_lru_add(pvec, lru);
-	put_cpu_var(lru_add_pvecs);
+	const int is_cma = 0;
 #else
-	struct pagevec *pvec;
 	int is_cma;
 
 	/* FIXME: too slow */
 	is_cma = is_cma_pageblock(page);
+#endif
 
-	pvec = &get_cpu_var(lru_add_pvecs)[lru];
+	VM_BUG_ON(is_unevictable_lru(lru));
+
+	batch = &get_cpu_var(lru_add_batches)[lru];
 
 	page_cache_get(page);
-	if (!pagevec_add(pvec, page) || is_cma)
-		____pagevec_lru_add(pvec, lru);
-	put_cpu_var(lru_add_pvecs);
-#endif
+	batch->pages[batch->nr++] = page;
+	if (batch->nr >= lru_batch_limit(batch) || is_cma)
+		lru_batch_flush(batch, ____pagevec_lru_add_fn, (void *)lru);
+	put_cpu_var(lru_add_batches);
 }
 EXPORT_SYMBOL(__lru_cache_add);
 
@@ -495,8 +629,10 @@ static void lru_deactivate_fn(struct page *page, void *arg)
 		 * The page's writeback ends up during pagevec
 		 * We moves tha page into tail of inactive.
 		 */
-		list_move_tail(&page->lru, &zone->lru[lru].list);
-		mem_cgroup_rotate_reclaimable_page(page);
+		if (!lru_gen_rotate_page(zone, page)) {
+			list_move_tail(&page->lru, &zone->lru[lru].list);
+			mem_cgroup_rotate_reclaimable_page(page);
+		}
 		__count_vm_event(PGROTATED);
 	}
 
@@ -512,23 +648,26 @@ static void lru_deactivate_fn(struct page *page, void *arg)
  */
 static void drain_cpu_pagevecs(int cpu)
 {
-	struct pagevec *pvecs = per_cpu(lru_add_pvecs, cpu);
+	struct lru_batch *batches = per_cpu(lru_add_batches, cpu);
+	struct lru_batch *batch;
 	struct pagevec *pvec;
 	int lru;
 
 	for_each_lru(lru) {
-		pvec = &pvecs[lru - LRU_BASE];
-		if (pagevec_count(pvec))
-			____pagevec_lru_add(pvec, lru);
+		batch = &batches[lru - LRU_BASE];
+		if (batch->nr)
+			lru_batch_flush(batch, ____pagevec_lru_add_fn,
+					(void *)(unsigned long)lru);
 	}
 
-	pvec = &per_cpu(lru_rotate_pvecs, cpu);
-	if (pagevec_count(pvec)) {
+	batch = &per_cpu(lru_rotate_batch, cpu);
+	if (batch->nr) {
 		unsigned long flags;
 
 		/* No harm done if a racing interrupt already did this */
 		local_irq_save(flags);
-		pagevec_move_tail(pvec);
+		if (batch->nr)
+			lru_rotate_flush(batch);
 		local_irq_restore(flags);
 	}
 
@@ -696,7 +835,9 @@ void lru_add_page_tail(struct zone* zone,
 			lru = LRU_INACTIVE_ANON;
 		}
 		update_page_reclaim_stat(zone, page_tail, file, active);
-		if (likely(PageLRU(page)))
+		if (lru_gen_add_page(zone, page_tail, false))
+			return;
+		if (likely(PageLRU(page)) && page_lru_gen(page) < 0)
 			head = page->lru.prev;
 		else
 			head = &zone->lru[lru].list;
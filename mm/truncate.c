@@ -183,6 +183,44 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Drop the shadow entries left by evicted pages in [start, end]: the data
+ * they stood for is gone, and they would keep the tree nodes around.
+ */
+static void truncate_shadow_entries(struct address_space *mapping,
+				    pgoff_t start, pgoff_t end)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	unsigned int i, nr;
+
+	spin_lock_irq(&mapping->tree_lock);
+	while (mapping->nrshadows && start <= end) {
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, start, PAGEVEC_SIZE);
+		if (!nr)
+			break;
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			void *entry;
+
+			/* Deletion may free the nodes the other slots are in */
+			entry = radix_tree_lookup(&mapping->page_tree,
+						  indices[i]);
+			if (!radix_tree_exceptional_entry(entry))
+				continue;
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			mapping->nrshadows--;
+			workingset_forget();
+		}
+		if (i < nr)
+			break;
+		start = indices[nr - 1] + 1;
+		if (!start)
+			break;
+	}
+	spin_unlock_irq(&mapping->tree_lock);
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -213,11 +251,15 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t end;
 	const unsigned partial = lstart & (PAGE_CACHE_SIZE - 1);
 	struct pagevec pvec;
+	unsigned long nrpages;
 	pgoff_t next;
 	int i;
 
 	cleancache_flush_inode(mapping);
-	if (mapping->nrpages == 0)
+	/* Pairs with the smp_wmb() in page_cache_tree_delete() */
+	nrpages = mapping->nrpages;
+	smp_rmb();
+	if (nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -294,6 +336,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		pagevec_release(&pvec);
 		mem_cgroup_uncharge_end();
 	}
+	truncate_shadow_entries(mapping, start, end);
 	cleancache_flush_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -404,7 +447,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
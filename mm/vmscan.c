@@ -48,6 +48,7 @@
 #include <asm/div64.h>
 
 #include <linux/swapops.h>
+#include <linux/hugetlb.h>
 
 #include "internal.h"
 
@@ -99,6 +100,9 @@ struct scan_control {
 
 	int order;
 
+	/* Reclaim pages even if they were referenced recently */
+	int ignore_references;
+
 	/*
 	 * Intend to reclaim enough continuous memory rather than reclaim
 	 * enough amount of memory. i.e, mode for high order allocation.
@@ -481,7 +485,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -527,10 +532,17 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		swapcache_free(swap, page);
 	} else {
 		void (*freepage)(struct page *);
+		void *shadow = NULL;
 
 		freepage = mapping->a_ops->freepage;
 
-		__delete_from_page_cache(page);
+		/*
+		 * Remember when a reclaimed file page left, so that its
+		 * refault can tell whether it belongs to the working set.
+		 */
+		if (reclaimed && page_is_file_cache(page))
+			shadow = workingset_eviction(page);
+		__delete_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 
@@ -553,7 +565,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -653,8 +665,9 @@ static enum page_references page_check_references(struct page *page,
 	referenced_ptes = page_referenced(page, 1, sc->mem_cgroup, &vm_flags);
 	referenced_page = TestClearPageReferenced(page);
 
-	/* Lumpy reclaim - ignore references */
-	if (sc->reclaim_mode & RECLAIM_MODE_LUMPYRECLAIM)
+	/* Lumpy and per-process reclaim - ignore references */
+	if ((sc->reclaim_mode & RECLAIM_MODE_LUMPYRECLAIM) ||
+	    sc->ignore_references)
 		return PAGEREF_RECLAIM;
 
 	/*
@@ -911,7 +924,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -972,6 +985,62 @@ keep_lumpy:
 	return nr_reclaimed;
 }
 
+#ifdef CONFIG_PROCESS_RECLAIM
+/**
+ * reclaim_pages_from_list - reclaim pages isolated by their owner
+ * @page_list: pages taken off the LRU with isolate_lru_page()
+ *
+ * Reclaims the pages however recently they were referenced: anon pages
+ * are swapped out, dirty file pages written back where possible. The
+ * pages must have been counted in NR_ISOLATED_ANON/FILE; what cannot be
+ * reclaimed is put back on the LRU. Returns the number of pages reclaimed.
+ */
+unsigned long reclaim_pages_from_list(struct list_head *page_list)
+{
+	struct scan_control sc = {
+		.gfp_mask = GFP_KERNEL,
+		.may_writepage = !laptop_mode,
+		.may_unmap = 1,
+		.may_swap = 1,
+		.swappiness = vm_swappiness,
+		.ignore_references = 1,
+		.reclaim_mode = RECLAIM_MODE_SINGLE | RECLAIM_MODE_ASYNC,
+	};
+	unsigned long nr_reclaimed = 0;
+	LIST_HEAD(zone_list);
+	struct page *page, *next;
+
+	/* shrink_page_list() works on one zone at a time */
+	while (!list_empty(page_list)) {
+		struct zone *zone = page_zone(lru_to_page(page_list));
+
+		/*
+		 * Reclaimed pages are freed by shrink_page_list(), so they
+		 * stop counting as isolated here rather than on putback.
+		 * shrink_page_list() also expects them to be inactive.
+		 */
+		list_for_each_entry_safe(page, next, page_list, lru) {
+			if (page_zone(page) != zone)
+				continue;
+			list_move(&page->lru, &zone_list);
+			ClearPageActive(page);
+			dec_zone_page_state(page, NR_ISOLATED_ANON +
+					    page_is_file_cache(page));
+		}
+
+		nr_reclaimed += shrink_page_list(&zone_list, zone, &sc);
+
+		while (!list_empty(&zone_list)) {
+			page = lru_to_page(&zone_list);
+			list_del(&page->lru);
+			putback_lru_page(page);
+		}
+	}
+
+	return nr_reclaimed;
+}
+#endif
+
 /*
  * Attempt to remove the specified page from its LRU.  Only take this page
  * if it is of the appropriate PageActive status.  Pages which are being
@@ -1120,6 +1189,10 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 			if (unlikely(page_zone_id(cursor_page) != zone_id))
 				break;
 
+			/* Pages on the multi-gen LRU are accounted there */
+			if (page_lru_gen(cursor_page) >= 0)
+				break;
+
 			/*
 			 * If we don't have enough swap space, reclaiming of
 			 * anon page which don't already have a swap slot is
@@ -1297,6 +1370,7 @@ putback_lru_pages(struct zone *zone, struct scan_control *sc,
 	struct page *page;
 	struct pagevec pvec;
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
+	u64 start;
 
 	pagevec_init(&pvec, 1);
 
@@ -1304,15 +1378,18 @@ putback_lru_pages(struct zone *zone, struct scan_control *sc,
 	 * Put back any unfreeable pages.
 	 */
 	spin_lock(&zone->lru_lock);
+	start = lru_lock_clock();
 	while (!list_empty(page_list)) {
 		int lru;
 		page = lru_to_page(page_list);
 		VM_BUG_ON(PageLRU(page));
 		list_del(&page->lru);
 		if (unlikely(!page_evictable(page, NULL))) {
+			lru_lock_account(start);
 			spin_unlock_irq(&zone->lru_lock);
 			putback_lru_page(page);
 			spin_lock_irq(&zone->lru_lock);
+			start = lru_lock_clock();
 			continue;
 		}
 		SetPageLRU(page);
@@ -1324,14 +1401,17 @@ putback_lru_pages(struct zone *zone, struct scan_control *sc,
 			reclaim_stat->recent_rotated[file] += numpages;
 		}
 		if (!pagevec_add(&pvec, page)) {
+			lru_lock_account(start);
 			spin_unlock_irq(&zone->lru_lock);
 			__pagevec_release(&pvec);
 			spin_lock_irq(&zone->lru_lock);
+			start = lru_lock_clock();
 		}
 	}
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON, -nr_anon);
 	__mod_zone_page_state(zone, NR_ISOLATED_FILE, -nr_file);
 
+	lru_lock_account(start);
 	spin_unlock_irq(&zone->lru_lock);
 	pagevec_release(&pvec);
 }
@@ -1422,6 +1502,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 	unsigned long nr_taken;
 	unsigned long nr_anon;
 	unsigned long nr_file;
+	u64 start;
 
 	while (unlikely(too_many_isolated(zone, file, sc))) {
 		congestion_wait(BLK_RW_ASYNC, HZ/10);
@@ -1434,6 +1515,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 	set_reclaim_mode(priority, sc, false);
 	lru_add_drain();
 	spin_lock_irq(&zone->lru_lock);
+	start = lru_lock_clock();
 
 	if (scanning_global_lru(sc)) {
 		nr_taken = isolate_pages_global(nr_to_scan,
@@ -1442,6 +1524,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 					ISOLATE_BOTH : ISOLATE_INACTIVE,
 			zone, 0, file);
 		zone->pages_scanned += nr_scanned;
+		__mod_zone_page_state(zone, NR_VMSCAN_SCANNED, nr_scanned);
 		if (current_is_kswapd())
 			__count_zone_vm_events(PGSCAN_KSWAPD, zone,
 					       nr_scanned);
@@ -1462,12 +1545,14 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 	}
 
 	if (nr_taken == 0) {
+		lru_lock_account(start);
 		spin_unlock_irq(&zone->lru_lock);
 		return 0;
 	}
 
 	update_isolated_counts(zone, sc, &nr_anon, &nr_file, &page_list);
 
+	lru_lock_account(start);
 	spin_unlock_irq(&zone->lru_lock);
 
 	nr_reclaimed = shrink_page_list(&page_list, zone, sc);
@@ -1482,6 +1567,8 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 	if (current_is_kswapd())
 		__count_vm_events(KSWAPD_STEAL, nr_reclaimed);
 	__count_zone_vm_events(PGSTEAL, zone, nr_reclaimed);
+	if (scanning_global_lru(sc))
+		__mod_zone_page_state(zone, NR_VMSCAN_RECLAIMED, nr_reclaimed);
 
 	putback_lru_pages(zone, sc, nr_anon, nr_file, &page_list);
 
@@ -1527,9 +1614,12 @@ static void move_active_pages_to_lru(struct zone *zone,
 		VM_BUG_ON(PageLRU(page));
 		SetPageLRU(page);
 
-		list_move(&page->lru, &zone->lru[lru].list);
-		mem_cgroup_add_lru_list(page, lru);
-		pgmoved += hpage_nr_pages(page);
+		list_del(&page->lru);
+		if (!lru_gen_add_page(zone, page, false)) {
+			list_add(&page->lru, &zone->lru[lru].list);
+			mem_cgroup_add_lru_list(page, lru);
+			pgmoved += hpage_nr_pages(page);
+		}
 
 		if (!pagevec_add(&pvec, page) || list_empty(list)) {
 			spin_unlock_irq(&zone->lru_lock);
@@ -1665,9 +1755,10 @@ static int inactive_anon_is_low(struct zone *zone, struct scan_control *sc)
 
 	/*
 	 * If we don't have swap space, anonymous page deactivation
-	 * is pointless.
+	 * is pointless. The multi-gen LRU has no active list to
+	 * deactivate from.
 	 */
-	if (!total_swap_pages)
+	if (!total_swap_pages || lru_gen_enabled())
 		return 0;
 
 	if (scanning_global_lru(sc))
@@ -1729,11 +1820,546 @@ static int inactive_list_is_low(struct zone *zone, struct scan_control *sc,
 		return inactive_anon_is_low(zone, sc);
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-gen LRU
+ *
+ * The active/inactive scheme finds out whether a page is still in use by
+ * checking its references through rmap when it is about to leave the
+ * active list, one page at a time, and anon pages that are mapped but
+ * never touched again linger on the active list until that happens. The
+ * multi-gen LRU ages pages in bulk instead: an aging pass walks the page
+ * tables of all processes, harvests the accessed bits of their ptes and
+ * moves the pages found young into the youngest generation. Eviction
+ * takes the oldest generation as it is, and only the pages about to be
+ * reclaimed go through page_referenced() in shrink_page_list().
+ *
+ * The page table walk is left to kswapd, which can afford to sleep and
+ * to drop the last reference to an mm. Direct reclaim that runs out of
+ * generations opens a new one without the walk and leaves the references
+ * of mapped pages to shrink_page_list().
+ */
+
+#ifdef CONFIG_LRU_GEN_ENABLED
+bool __lru_gen_enabled __read_mostly = true;
+#else
+bool __lru_gen_enabled __read_mostly;
+#endif
+
+/* All mms that may be walked, protected by lru_gen_mm_lock */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+#define LRU_GEN_WALK_BATCH	64
+
+/* Pages found young, moved under lru_lock a batch at a time */
+struct lru_gen_walk {
+	struct vm_area_struct *vma;
+	unsigned long nr_young;
+	int nr;
+	struct page *pages[LRU_GEN_WALK_BATCH];
+};
+
+/* One walk at a time, and too big for the stack of kswapd */
+static DEFINE_MUTEX(lru_gen_walk_mutex);
+static struct lru_gen_walk lru_gen_walk_state;
+
+void lru_gen_init_zone(struct zone *zone)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	int gen, type;
+
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		for (type = 0; type < 2; type++)
+			INIT_LIST_HEAD(&lrugen->lists[gen][type]);
+	}
+	lrugen->max_seq = MIN_NR_GENS - 1;
+}
+
+void lru_gen_init_mm(struct mm_struct *mm)
+{
+	INIT_LIST_HEAD(&mm->lru_gen_list);
+}
+
+/* Called once the mm is fully set up and its vmas are its own */
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del_init(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+/* Moves the batch of young pages into the youngest generation of their zone */
+static void lru_gen_walk_flush(struct lru_gen_walk *walk)
+{
+	struct zone *zone = NULL;
+	int i;
+
+	for (i = 0; i < walk->nr; i++) {
+		struct page *page = walk->pages[i];
+		struct zone *pagezone = page_zone(page);
+		int type = page_is_file_cache(page);
+		int old_gen, new_gen;
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+
+		/* Isolated, or on the other lists after a switch */
+		old_gen = page_lru_gen(page);
+		new_gen = lru_gen_from_seq(zone->lrugen.max_seq);
+		if (!PageLRU(page) || old_gen < 0 || old_gen == new_gen ||
+		    !lru_gen_enabled())
+			continue;
+
+		page_set_lru_gen(page, new_gen);
+		lru_gen_update_size(zone, page, old_gen, new_gen);
+		list_move(&page->lru, &zone->lrugen.lists[new_gen][type]);
+		walk->nr_young += hpage_nr_pages(page);
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+
+	release_pages(walk->pages, walk->nr, 0);
+	walk->nr = 0;
+}
+
+static int lru_gen_walk_pmd(pmd_t *pmd, unsigned long addr,
+			    unsigned long end, struct mm_walk *mm_walk)
+{
+	struct lru_gen_walk *walk = mm_walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || !PageLRU(page))
+			continue;
+
+		/*
+		 * The TLB is not flushed: a stale entry only hides accesses
+		 * until it is evicted, which is better than an IPI per pmd.
+		 */
+		if (!ptep_test_and_clear_young(vma, addr, pte))
+			continue;
+
+		get_page(page);
+		walk->pages[walk->nr++] = page;
+		if (walk->nr == LRU_GEN_WALK_BATCH)
+			lru_gen_walk_flush(walk);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+
+	return 0;
+}
+
+static void lru_gen_walk_mm(struct lru_gen_walk *walk, struct mm_struct *mm)
+{
+	struct mm_walk mm_walk = {
+		.pmd_entry = lru_gen_walk_pmd,
+		.mm = mm,
+		.private = walk,
+	};
+	struct vm_area_struct *vma;
+
+	/* Do not wait behind a writer, who may be waiting for memory */
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_IO | VM_PFNMAP | VM_LOCKED) ||
+		    is_vm_hugetlb_page(vma))
+			continue;
+
+		walk->vma = vma;
+		walk_page_range(vma->vm_start, vma->vm_end, &mm_walk);
+	}
+	up_read(&mm->mmap_sem);
+
+	if (walk->nr)
+		lru_gen_walk_flush(walk);
+}
+
+/*
+ * Walks the page tables of every mm that still has users. Holding a user
+ * reference keeps the current mm on the list, so the walk can resume
+ * from it after dropping the lock.
+ */
+static void lru_gen_walk_all(void)
+{
+	struct lru_gen_walk *walk = &lru_gen_walk_state;
+	struct mm_struct *mm, *prev = NULL;
+
+	do {
+		struct list_head *pos;
+
+		mm = NULL;
+		spin_lock(&lru_gen_mm_lock);
+		pos = prev ? &prev->lru_gen_list : &lru_gen_mm_list;
+		while ((pos = pos->next) != &lru_gen_mm_list) {
+			struct mm_struct *next;
+
+			next = list_entry(pos, struct mm_struct, lru_gen_list);
+			if (atomic_inc_not_zero(&next->mm_users)) {
+				mm = next;
+				break;
+			}
+		}
+		spin_unlock(&lru_gen_mm_lock);
+
+		if (prev)
+			mmput(prev);
+		if (mm)
+			lru_gen_walk_mm(walk, mm);
+		prev = mm;
+	} while (mm);
+
+	count_vm_events(LRU_GEN_YOUNG, walk->nr_young);
+	walk->nr_young = 0;
+}
+
+/* Retires the oldest generations of @type as long as they are empty */
+static void lru_gen_inc_min_seq(struct zone *zone, int type)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+
+	while (lrugen->max_seq - lrugen->min_seq[type] + 1 > MIN_NR_GENS) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+
+		if (!list_empty(&lrugen->lists[gen][type]))
+			break;
+		lrugen->min_seq[type]++;
+	}
+}
+
+/*
+ * Opens a new youngest generation, unless someone else did since @max_seq
+ * was read. When all generations of a type are in use, the oldest one is
+ * merged into the next first, a batch at a time: returns false if that
+ * is not done yet and the caller should drop lru_lock and try again.
+ */
+static bool lru_gen_inc_max_seq(struct zone *zone, unsigned long max_seq)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	int gen, type;
+
+	if (max_seq != lrugen->max_seq)
+		return true;
+
+	for (type = 0; type < 2; type++) {
+		struct list_head *head;
+		int batch = SWAP_CLUSTER_MAX;
+		int next;
+
+		if (max_seq - lrugen->min_seq[type] + 1 < MAX_NR_GENS)
+			continue;
+
+		gen = lru_gen_from_seq(lrugen->min_seq[type]);
+		next = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+		head = &lrugen->lists[gen][type];
+		/* Youngest first, so they stay in order behind the next */
+		while (!list_empty(head)) {
+			struct page *page = list_first_entry(head, struct page,
+							     lru);
+
+			page_set_lru_gen(page, next);
+			lru_gen_update_size(zone, page, gen, next);
+			list_move_tail(&page->lru, &lrugen->lists[next][type]);
+			if (!--batch)
+				return false;
+		}
+		lrugen->min_seq[type]++;
+	}
+
+	/* The second youngest generation is not reported as active anymore */
+	gen = lru_gen_from_seq(max_seq - 1);
+	for (type = 0; type < 2; type++) {
+		enum lru_list l = LRU_BASE + type * LRU_FILE;
+		long delta = lrugen->nr_pages[gen][type];
+
+		__mod_zone_page_state(zone, NR_LRU_BASE + l + LRU_ACTIVE, -delta);
+		__mod_zone_page_state(zone, NR_LRU_BASE + l, delta);
+	}
+	lrugen->max_seq++;
+
+	return true;
+}
+
+static void lru_gen_age(struct zone *zone, unsigned long max_seq)
+{
+	if (current_is_kswapd() && mutex_trylock(&lru_gen_walk_mutex)) {
+		lru_gen_walk_all();
+		mutex_unlock(&lru_gen_walk_mutex);
+	}
+
+	spin_lock_irq(&zone->lru_lock);
+	while (!lru_gen_inc_max_seq(zone, max_seq)) {
+		spin_unlock_irq(&zone->lru_lock);
+		cond_resched();
+		spin_lock_irq(&zone->lru_lock);
+	}
+	spin_unlock_irq(&zone->lru_lock);
+
+	count_vm_event(LRU_GEN_AGING);
+}
+
+/*
+ * Evicts up to @nr_to_scan pages of the oldest generation of @file type,
+ * aging first if only the two youngest generations are left. Counts as
+ * shrink_inactive_list() does, and puts back what shrink_page_list()
+ * keeps, which goes into the youngest generation if it was referenced.
+ */
+static unsigned long lru_gen_shrink_list(unsigned long nr_to_scan,
+			struct zone *zone, struct scan_control *sc,
+			int priority, int file)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
+	LIST_HEAD(page_list);
+	unsigned long nr_scanned = 0;
+	unsigned long nr_taken = 0;
+	unsigned long nr_reclaimed;
+	unsigned long max_seq;
+	struct list_head *head;
+
+	while (unlikely(too_many_isolated(zone, file, sc))) {
+		congestion_wait(BLK_RW_ASYNC, HZ/10);
+
+		/* We are about to die and free our memory. Return now. */
+		if (fatal_signal_pending(current))
+			return SWAP_CLUSTER_MAX;
+	}
+
+	/* Generations are not physically contiguous, there is no lumpy mode */
+	set_reclaim_mode(priority, sc, false);
+	if (sc->reclaim_mode & RECLAIM_MODE_LUMPYRECLAIM)
+		reset_reclaim_mode(sc);
+	lru_add_drain();
+	spin_lock_irq(&zone->lru_lock);
+
+	lru_gen_inc_min_seq(zone, file);
+	max_seq = lrugen->max_seq;
+	if (max_seq - lrugen->min_seq[file] + 1 <= MIN_NR_GENS) {
+		spin_unlock_irq(&zone->lru_lock);
+		lru_gen_age(zone, max_seq);
+		spin_lock_irq(&zone->lru_lock);
+		lru_gen_inc_min_seq(zone, file);
+	}
+
+	head = &lrugen->lists[lru_gen_from_seq(lrugen->min_seq[file])][file];
+	while (nr_scanned < nr_to_scan && !list_empty(head)) {
+		struct page *page = lru_to_page(head);
+
+		prefetchw_prev_lru_page(page, head, flags);
+		VM_BUG_ON(!PageLRU(page));
+		nr_scanned++;
+
+		if (__isolate_lru_page(page, ISOLATE_BOTH, file)) {
+			/* It is being freed elsewhere */
+			list_move(&page->lru, head);
+			continue;
+		}
+		lru_gen_del_page(zone, page, true);
+		list_add(&page->lru, &page_list);
+		nr_taken += hpage_nr_pages(page);
+	}
+
+	zone->pages_scanned += nr_scanned;
+	__mod_zone_page_state(zone, NR_VMSCAN_SCANNED, nr_scanned);
+	if (current_is_kswapd())
+		__count_zone_vm_events(PGSCAN_KSWAPD, zone, nr_scanned);
+	else
+		__count_zone_vm_events(PGSCAN_DIRECT, zone, nr_scanned);
+	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, nr_taken);
+	reclaim_stat->recent_scanned[file] += nr_taken;
+	spin_unlock_irq(&zone->lru_lock);
+
+	if (!nr_taken)
+		return 0;
+
+	nr_reclaimed = shrink_page_list(&page_list, zone, sc);
+
+	local_irq_disable();
+	if (current_is_kswapd())
+		__count_vm_events(KSWAPD_STEAL, nr_reclaimed);
+	__count_zone_vm_events(PGSTEAL, zone, nr_reclaimed);
+	__mod_zone_page_state(zone, NR_VMSCAN_RECLAIMED, nr_reclaimed);
+
+	putback_lru_pages(zone, sc, file ? 0 : nr_taken, file ? nr_taken : 0,
+			  &page_list);
+	return nr_reclaimed;
+}
+
+/*
+ * Moves the evictable pages of @zone onto the lists now in use. The
+ * youngest two generations and the active lists map onto each other, so
+ * what is known about the pages survives the switch.
+ */
+static void lru_gen_switch_zone(struct zone *zone, bool enable)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	int batch = SWAP_CLUSTER_MAX;
+	struct list_head *head;
+	struct page *page;
+	enum lru_list l;
+	unsigned long seq;
+	int type;
+
+	spin_lock_irq(&zone->lru_lock);
+	if (enable) {
+		for_each_evictable_lru(l) {
+			head = &zone->lru[l].list;
+			while (!list_empty(head)) {
+				page = lru_to_page(head);
+				del_page_from_lru_list(zone, page, l);
+				add_page_to_lru_list(zone, page, l);
+				if (!--batch) {
+					spin_unlock_irq(&zone->lru_lock);
+					cond_resched();
+					spin_lock_irq(&zone->lru_lock);
+					batch = SWAP_CLUSTER_MAX;
+				}
+			}
+		}
+		goto out;
+	}
+
+	for (type = 0; type < 2; type++) {
+		for (seq = lrugen->min_seq[type]; seq <= lrugen->max_seq;
+		     seq++) {
+			int gen = lru_gen_from_seq(seq);
+
+			head = &lrugen->lists[gen][type];
+			while (!list_empty(head)) {
+				page = lru_to_page(head);
+				lru_gen_del_page(zone, page, false);
+				add_page_to_lru_list(zone, page, page_lru(page));
+				if (!--batch) {
+					spin_unlock_irq(&zone->lru_lock);
+					cond_resched();
+					spin_lock_irq(&zone->lru_lock);
+					batch = SWAP_CLUSTER_MAX;
+				}
+			}
+		}
+	}
+out:
+	spin_unlock_irq(&zone->lru_lock);
+}
+
+static DEFINE_MUTEX(lru_gen_state_mutex);
+
+static void lru_gen_set_enabled(bool enable)
+{
+	struct zone *zone;
+
+	mutex_lock(&lru_gen_state_mutex);
+	if (enable != __lru_gen_enabled) {
+		/* Taking lru_lock below orders this before the moves */
+		__lru_gen_enabled = enable;
+		lru_add_drain_all();
+		for_each_populated_zone(zone)
+			lru_gen_switch_zone(zone, enable);
+	}
+	mutex_unlock(&lru_gen_state_mutex);
+}
+
+static int __init setup_lru_gen(char *str)
+{
+	if (!strcmp(str, "on"))
+		__lru_gen_enabled = true;
+	else if (!strcmp(str, "off"))
+		__lru_gen_enabled = false;
+	else
+		return 0;
+	return 1;
+}
+__setup("lru_gen=", setup_lru_gen);
+
+#ifdef CONFIG_SYSFS
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled());
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long enable;
+	int err;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	lru_gen_set_enabled(enable);
+	return count;
+}
+
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lru_gen_attr_group = {
+	.attrs = lru_gen_attrs,
+	.name = "lru_gen",
+};
+
+static int __init lru_gen_init(void)
+{
+	BUILD_BUG_ON(MAX_NR_GENS + 1 > 1U << LRU_GEN_WIDTH);
+
+	return sysfs_create_group(mm_kobj, &lru_gen_attr_group);
+}
+module_init(lru_gen_init);
+#endif /* CONFIG_SYSFS */
+
+#else /* !CONFIG_LRU_GEN */
+
+static inline unsigned long lru_gen_shrink_list(unsigned long nr_to_scan,
+			struct zone *zone, struct scan_control *sc,
+			int priority, int file)
+{
+	return 0;
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static unsigned long shrink_list(enum lru_list lru, unsigned long nr_to_scan,
 	struct zone *zone, struct scan_control *sc, int priority)
 {
 	int file = is_file_lru(lru);
 
+	if (lru_gen_enabled())
+		return lru_gen_shrink_list(nr_to_scan, zone, sc, priority, file);
+
 	if (is_active_lru(lru)) {
 		if (inactive_list_is_low(zone, sc, file))
 		    shrink_active_list(nr_to_scan, zone, sc, priority, file);
@@ -2113,8 +2739,10 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 	get_mems_allowed();
 	delayacct_freepages_start();
 
-	if (scanning_global_lru(sc))
+	if (scanning_global_lru(sc)) {
 		count_vm_event(ALLOCSTALL);
+		lru_add_pressure();
+	}
 
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
 		sc->nr_scanned = 0;
@@ -2448,6 +3076,10 @@ loop_again:
 		if (!priority)
 			disable_swap_token(NULL);
 
+		/* Keep pages from hiding in the per-cpu LRU batches */
+		if (priority < DEF_PRIORITY - 2)
+			lru_add_pressure();
+
 		all_zones_ok = 1;
 		balanced = 0;
 
@@ -2712,6 +3344,12 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 		 * them before going back to sleep.
 		 */
 		set_pgdat_percpu_threshold(pgdat, calculate_normal_threshold);
+
+		/*
+		 * kswapd freed enough memory for the order it was asked for;
+		 * have kcompactd assemble the free pages into a block of it.
+		 */
+		wakeup_kcompactd(pgdat, order, classzone_idx);
 		schedule();
 		set_pgdat_percpu_threshold(pgdat, calculate_pressure_threshold);
 	} else {
@@ -3254,9 +3892,12 @@ retry:
 		enum lru_list l = page_lru_base_type(page);
 
 		__dec_zone_state(zone, NR_UNEVICTABLE);
-		list_move(&page->lru, &zone->lru[l].list);
-		mem_cgroup_move_lists(page, LRU_UNEVICTABLE, l);
-		__inc_zone_state(zone, NR_INACTIVE_ANON + l);
+		list_del(&page->lru);
+		if (!lru_gen_add_page(zone, page, false)) {
+			list_add(&page->lru, &zone->lru[l].list);
+			mem_cgroup_move_lists(page, LRU_UNEVICTABLE, l);
+			__inc_zone_state(zone, NR_INACTIVE_ANON + l);
+		}
 		__count_vm_event(UNEVICTABLE_PGRESCUED);
 	} else {
 		/*
@@ -715,6 +715,10 @@ const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_dirtied",
 	"nr_written",
+	"nr_vmscan_scanned",
+	"nr_vmscan_reclaimed",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -765,6 +769,9 @@ const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"lru_lock_batches",
+	"lru_lock_contended",
+	"lru_lock_hold_us",
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
@@ -773,6 +780,14 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_stall_us",
+	"compact_daemon_wake",
+	"compact_daemon_us",
+#endif
+
+#ifdef CONFIG_LRU_GEN
+	"lru_gen_aging",
+	"lru_gen_young",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -0,0 +1,136 @@
+/*
+ * linux/mm/workingset.c
+ *
+ * Workingset detection
+ *
+ * When a page cache page is reclaimed, a shadow entry is left behind in
+ * its slot of the mapping's radix tree. When the page is read back in,
+ * the shadow entry tells how long the page was gone and decides whether
+ * it should start out on the active list instead of the inactive one.
+ *
+ * Every zone keeps a counter, inactive_age, that is bumped whenever a
+ * page is evicted from or activated out of the inactive file list. The
+ * shadow entry of an evicted page records the zone and the counter at
+ * the time of eviction. On refault, the difference to the current
+ * counter is the refault distance: the minimum number of inactive slots
+ * the page would have needed to survive until it was accessed again.
+ *
+ * Those slots could only come from the active list. So when the refault
+ * distance is no bigger than the active file list, the page would have
+ * stayed resident had the inactive list been given the room, and it is
+ * activated right away. Pages of a working set that is bigger than the
+ * inactive list but would fit into memory then stop evicting each other
+ * on every pass, instead of being treated as used-once streaming data.
+ */
+
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/pagemap.h>
+#include <linux/radix-tree.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+/*
+ * Shadow entries pin radix tree nodes of files that stay cached. A shadow
+ * older than the whole of memory can never activate its page again, so
+ * there is no point in keeping more of them than there are pages.
+ */
+static atomic_long_t nr_shadows = ATOMIC_LONG_INIT(0);
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction, refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	/*
+	 * The counter is truncated to the bits left in the entry, so the
+	 * distance is computed modulo that. A page that stayed away long
+	 * enough for the counter to wrap may be activated wrongly once,
+	 * which is harmless.
+	 */
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in place of the page in its
+ * mapping, or NULL if too many shadow entries are around already.
+ * Called with the mapping's tree_lock held.
+ */
+void *workingset_eviction(struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	if (atomic_long_read(&nr_shadows) >= totalram_pages)
+		return NULL;
+	atomic_long_inc(&nr_shadows);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: the shadow entry of the evicted page
+ *
+ * Returns true if the page should be activated on the LRU, false
+ * otherwise. The shadow entry has been removed from the mapping.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/**
+ * workingset_forget - note that a shadow entry has left its mapping
+ */
+void workingset_forget(void)
+{
+	atomic_long_dec(&nr_shadows);
+}
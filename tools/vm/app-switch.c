@@ -0,0 +1,301 @@
+/*
+ * app-switch: replay switching between applications under memory pressure
+ *
+ * Every "app" is a process holding an anonymous working set and a file
+ * mapping. Switching to an app makes it touch its working set again, the
+ * way a task brought back to the foreground does, and the time that takes
+ * is the switch latency. When the apps together do not fit into memory,
+ * each switch has to fault back in what reclaim took away, so latency
+ * shows how well reclaim picked what to evict.
+ *
+ * The order of switches comes from a trace file with one app index per
+ * line, or is drawn at random with app i about 1/(i+1) as popular as the
+ * first, like the recents list of a phone.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o app-switch app-switch.c
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+struct app {
+	pid_t pid;
+	int cmd;	/* parent -> app */
+	int done;	/* app -> parent */
+};
+
+static int nr_apps = 8;
+static size_t anon_mb = 32;
+static size_t file_mb = 16;
+static int hot_pct = 50;
+static int nr_switches = 200;
+static int interval_ms;
+static unsigned int seed = 1;
+static const char *dir = "/data/local/tmp/app-switch";
+static const char *trace;
+static long page_size;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"app-switch [-n apps] [-a anon MB] [-f file MB] [-w hot %%]\n"
+		"           [-s switches] [-i interval ms] [-S seed]\n"
+		"           [-d dir] [-t trace]\n");
+	exit(1);
+}
+
+static void fatal(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Half text-like, half zero, so compressed swap has something to do */
+static void fill(char *buf, size_t len, unsigned int salt)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += page_size) {
+		size_t j;
+
+		for (j = 0; j < (size_t)page_size / 2; j++)
+			buf[i + j] = 'a' + (i / page_size + j + salt) % 26;
+		memset(buf + i + page_size / 2, 0, page_size / 2);
+	}
+}
+
+static char *map_file(int idx, size_t len)
+{
+	char path[256], *buf;
+	size_t off;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/app%d", dir, idx);
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		fatal(path);
+
+	buf = malloc(1 << 20);
+	if (!buf)
+		fatal("malloc");
+	fill(buf, 1 << 20, idx);
+	for (off = 0; off < len; off += 1 << 20) {
+		if (pwrite(fd, buf, 1 << 20, off) != 1 << 20)
+			fatal("pwrite");
+	}
+	free(buf);
+
+	buf = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED)
+		fatal("mmap file");
+	close(fd);
+
+	return buf;
+}
+
+/*
+ * The hot part of each set is touched on every switch; of the rest, a
+ * different slice each time, so the app also reaches into colder memory.
+ */
+static void app_main(int idx, int cmd, int done)
+{
+	size_t anon_len = anon_mb << 20, file_len = file_mb << 20;
+	size_t anon_hot = anon_len / 100 * hot_pct;
+	size_t file_hot = file_len / 100 * hot_pct;
+	volatile char *file;
+	unsigned long round = 0;
+	char *anon;
+	char c = 0;
+
+	anon = mmap(NULL, anon_len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (anon == MAP_FAILED)
+		fatal("mmap anon");
+	fill(anon, anon_len, idx);
+	file = (volatile char *)map_file(idx, file_len);
+
+	if (write(done, &c, 1) != 1)
+		exit(1);
+
+	while (read(cmd, &c, 1) == 1) {
+		size_t off, cold;
+		unsigned int sum = 0;
+
+		for (off = 0; off < anon_hot; off += page_size)
+			anon[off]++;
+		for (off = 0; off < file_hot; off += page_size)
+			sum += file[off];
+
+		cold = (anon_len - anon_hot) / 4;
+		off = anon_hot + (round % 4) * cold;
+		for (; off < anon_hot + (round % 4 + 1) * cold; off += page_size)
+			anon[off]++;
+		round++;
+
+		c = sum;
+		if (write(done, &c, 1) != 1)
+			break;
+	}
+	exit(0);
+}
+
+static int next_app(FILE *f)
+{
+	double r, total = 0, acc = 0;
+	int i, idx;
+
+	if (f) {
+		if (fscanf(f, "%d", &idx) != 1)
+			return -1;
+		return idx % nr_apps;
+	}
+
+	for (i = 0; i < nr_apps; i++)
+		total += 1.0 / (i + 1);
+	r = (double)rand_r(&seed) / RAND_MAX * total;
+	for (i = 0; i < nr_apps - 1; i++) {
+		acc += 1.0 / (i + 1);
+		if (r < acc)
+			break;
+	}
+	return i;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long *lat, start, sum = 0;
+	struct app *apps;
+	FILE *f = NULL;
+	int i, n, opt, last = -1;
+	char c = 0;
+
+	while ((opt = getopt(argc, argv, "n:a:f:w:s:i:S:d:t:h")) != -1) {
+		switch (opt) {
+		case 'n': nr_apps = atoi(optarg); break;
+		case 'a': anon_mb = atoi(optarg); break;
+		case 'f': file_mb = atoi(optarg); break;
+		case 'w': hot_pct = atoi(optarg); break;
+		case 's': nr_switches = atoi(optarg); break;
+		case 'i': interval_ms = atoi(optarg); break;
+		case 'S': seed = atoi(optarg); break;
+		case 'd': dir = optarg; break;
+		case 't': trace = optarg; break;
+		default: usage();
+		}
+	}
+	if (nr_apps < 1 || nr_switches < 1 || hot_pct < 0 || hot_pct > 100)
+		usage();
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (mkdir(dir, 0700) && errno != EEXIST)
+		fatal(dir);
+	if (trace) {
+		f = fopen(trace, "r");
+		if (!f)
+			fatal(trace);
+	}
+
+	apps = calloc(nr_apps, sizeof(*apps));
+	lat = calloc(nr_switches, sizeof(*lat));
+	if (!apps || !lat)
+		fatal("calloc");
+
+	/* Launch the apps one after the other, like a boot */
+	for (i = 0; i < nr_apps; i++) {
+		int cmd[2], done[2];
+
+		if (pipe(cmd) || pipe(done))
+			fatal("pipe");
+		apps[i].pid = fork();
+		if (apps[i].pid < 0)
+			fatal("fork");
+		if (!apps[i].pid) {
+			int j;
+
+			/* Only the parent may hold the other apps' pipes */
+			for (j = 0; j < i; j++) {
+				close(apps[j].cmd);
+				close(apps[j].done);
+			}
+			close(cmd[1]);
+			close(done[0]);
+			app_main(i, cmd[0], done[1]);
+		}
+		close(cmd[0]);
+		close(done[1]);
+		apps[i].cmd = cmd[1];
+		apps[i].done = done[0];
+		if (read(apps[i].done, &c, 1) != 1)
+			fatal("app start");
+	}
+
+	for (n = 0; n < nr_switches; n++) {
+		int idx = next_app(f);
+
+		if (idx < 0)
+			break;
+		if (idx == last) {
+			n--;
+			continue;
+		}
+		last = idx;
+
+		start = now_ns();
+		if (write(apps[idx].cmd, &c, 1) != 1 ||
+		    read(apps[idx].done, &c, 1) != 1)
+			fatal("switch");
+		lat[n] = now_ns() - start;
+		sum += lat[n];
+
+		if (interval_ms)
+			usleep(interval_ms * 1000);
+	}
+
+	for (i = 0; i < nr_apps; i++) {
+		close(apps[i].cmd);
+		waitpid(apps[i].pid, NULL, 0);
+		close(apps[i].done);
+	}
+	if (f)
+		fclose(f);
+	if (!n)
+		return 0;
+
+	qsort(lat, n, sizeof(*lat), cmp_ull);
+	printf("switches %d\n", n);
+	printf("latency_ms_mean %.2f\n", sum / 1e6 / n);
+	printf("latency_ms_p50 %.2f\n", lat[n / 2] / 1e6);
+	printf("latency_ms_p90 %.2f\n", lat[n * 9 / 10] / 1e6);
+	printf("latency_ms_p99 %.2f\n", lat[n * 99 / 100] / 1e6);
+	printf("latency_ms_max %.2f\n", lat[n - 1] / 1e6);
+
+	return 0;
+}
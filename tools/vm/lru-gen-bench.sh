@@ -0,0 +1,96 @@
+#!/bin/sh
+#
+# lru-gen-bench.sh - compare reclaim with and without the multi-gen LRU
+# on an app-switch workload.
+#
+# app-switch (built from app-switch.c next to this script) is run once
+# with the active/inactive lists and once with the multi-gen LRU, each
+# time from a dropped page cache and with the same random seed or trace.
+# For every run the switch latencies are printed along with the reclaim
+# work it took, from /proc/vmstat and the CPU time of kswapd0.
+#
+# Usage: lru-gen-bench.sh [-r runs] [app-switch options]
+#
+# Size the apps (-n, -a, -f) so that together they are about twice the
+# memory of the device, or nothing needs to be reclaimed.
+#
+# Licensed under the terms of the GNU GPL License version 2
+#
+
+SYS=/sys/kernel/mm/lru_gen/enabled
+BIN=${BIN:-$(dirname "$0")/app-switch}
+RUNS=1
+
+if [ "$1" = "-r" ]; then
+	RUNS=$2
+	shift 2
+fi
+
+if [ ! -e "$SYS" ]; then
+	echo "$SYS not found, is CONFIG_LRU_GEN enabled?" >&2
+	exit 1
+fi
+if [ ! -x "$BIN" ]; then
+	echo "$BIN not found, build it from app-switch.c" >&2
+	exit 1
+fi
+
+TMP=$(mktemp -d)
+ORIG=$(cat "$SYS")
+trap 'echo "$ORIG" > "$SYS"; rm -rf "$TMP"' EXIT
+
+EVENTS="pgscan_kswapd pgscan_direct pgsteal pgrefill pgactivate
+	pgdeactivate workingset_refault workingset_activate pswpin pswpout
+	allocstall lru_gen_aging lru_gen_young"
+
+# Sums the per-zone counters of each event into one line
+vmstat_snap()
+{
+	for e in $EVENTS; do
+		awk -v e="$e" '$1 == e || index($1, e "_") == 1 { s += $2 }
+			END { print e, s + 0 }' /proc/vmstat
+	done
+}
+
+kswapd_ticks()
+{
+	pid=$(pgrep -x kswapd0 2>/dev/null || pidof kswapd0)
+	awk '{ print $14 + $15 }' /proc/"$pid"/stat
+}
+
+for mode in 0 1; do
+	echo "$mode" > "$SYS"
+	r=0
+	while [ $r -lt "$RUNS" ]; do
+		sync
+		echo 3 > /proc/sys/vm/drop_caches
+
+		vmstat_snap > "$TMP/before"
+		k0=$(kswapd_ticks)
+		"$BIN" "$@" > "$TMP/lat.$mode.$r" || exit 1
+		k1=$(kswapd_ticks)
+		vmstat_snap > "$TMP/after"
+
+		{
+			cat "$TMP/lat.$mode.$r"
+			echo "kswapd_cpu_ms $(( (k1 - k0) * 1000 / \
+				$(getconf CLK_TCK) ))"
+			paste -d' ' "$TMP/before" "$TMP/after" |
+				awk '{ print $1, $4 - $2 }'
+		} > "$TMP/res.$mode.$r"
+		r=$((r + 1))
+	done
+done
+
+# One column per mode, averaged over the runs
+for mode in 0 1; do
+	cat "$TMP"/res.$mode.* | awk -v runs="$RUNS" '
+		{ s[$1] += $2; if (!($1 in o)) o[$1] = n++ }
+		END { for (k in s) printf "%d %s %.2f\n", o[k], k, s[k] / runs }' |
+		sort -n | cut -d' ' -f2- > "$TMP/avg.$mode"
+done
+
+printf "%-22s %14s %14s\n" "" "active/inactive" "multi-gen"
+paste -d' ' "$TMP/avg.0" "$TMP/avg.1" | while read -r k a _ b; do
+	printf "%-22s %14s %14s\n" "$k" "$a" "$b"
+done
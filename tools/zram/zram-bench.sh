@@ -0,0 +1,114 @@
+#!/bin/sh
+#
+# zram-bench.sh - measure zram throughput against the number of
+# compression streams.
+#
+# For every stream count from 1 to the number of online CPUs (or the
+# counts given with -s), the device is reset, sized, and then written and
+# read back by NJOBS parallel dd jobs, each working on its own slice of
+# the device. Aggregate write and read throughput, the compression ratio
+# and the mean per-page (de)compression time are printed per run.
+#
+# Usage: zram-bench.sh [-d zramN] [-j jobs] [-m MB per job] [-s "1 2 4"]
+#			[-c compressor]
+#
+# The data written is a mix of a text corpus and zeros so that pages are
+# compressible but not trivially so; set SRC to use another input file.
+#
+# Copyright (C) 2026 agent <agent@local>
+# Licensed under the terms of the GNU GPL License version 2
+#
+
+DEV=zram0
+NCPUS=$(grep -c '^processor' /proc/cpuinfo)
+NJOBS=$NCPUS
+MB=64
+STREAMS=""
+COMP=""
+SRC=${SRC:-}
+
+while getopts "c:d:j:m:s:h" opt; do
+	case $opt in
+	c) COMP=$OPTARG ;;
+	d) DEV=$OPTARG ;;
+	j) NJOBS=$OPTARG ;;
+	m) MB=$OPTARG ;;
+	s) STREAMS=$OPTARG ;;
+	*) sed -n '3,18p' "$0"; exit 1 ;;
+	esac
+done
+
+SYS=/sys/block/$DEV
+if [ ! -d "$SYS" ]; then
+	echo "$SYS not found, is the zram module loaded?" >&2
+	exit 1
+fi
+if [ ! -e "$SYS/max_comp_streams" ]; then
+	echo "$DEV does not support max_comp_streams" >&2
+	exit 1
+fi
+
+[ -z "$STREAMS" ] && STREAMS=$(seq 1 "$NCPUS")
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Build one MB-sized, moderately compressible chunk to feed the writers.
+if [ -z "$SRC" ]; then
+	SRC=$TMP/src
+	( cat /proc/kallsyms 2>/dev/null; dd if=/dev/zero bs=1M count=1 \
+		2>/dev/null ) | head -c 1048576 > "$SRC"
+fi
+i=0
+while [ $i -lt "$MB" ]; do
+	cat "$SRC"
+	i=$((i + 1))
+done | head -c $((MB * 1048576)) > "$TMP/data"
+
+now_ms()
+{
+	echo $(($(date +%s%N) / 1000000))
+}
+
+# run_jobs <write|read>: prints elapsed milliseconds
+run_jobs()
+{
+	start=$(now_ms)
+	j=0
+	while [ $j -lt "$NJOBS" ]; do
+		if [ "$1" = write ]; then
+			dd if="$TMP/data" of=/dev/$DEV bs=1M count="$MB" \
+				seek=$((j * MB)) oflag=direct conv=notrunc \
+				2>/dev/null &
+		else
+			dd if=/dev/$DEV of=/dev/null bs=1M count="$MB" \
+				skip=$((j * MB)) iflag=direct 2>/dev/null &
+		fi
+		j=$((j + 1))
+	done
+	wait
+	end=$(now_ms)
+	echo $((end - start))
+}
+
+printf "%8s %6s %12s %12s %12s %10s %10s\n" streams jobs "write MB/s" \
+	"read MB/s" "compr ratio" "comp ns" "decomp ns"
+
+for s in $STREAMS; do
+	echo 1 > "$SYS/reset"
+	[ -n "$COMP" ] && echo "$COMP" > "$SYS/comp_algorithm"
+	echo $((NJOBS * MB * 1048576)) > "$SYS/disksize"
+	echo "$s" > "$SYS/max_comp_streams"
+
+	wms=$(run_jobs write)
+	rms=$(run_jobs read)
+	[ "$wms" -gt 0 ] || wms=1
+	[ "$rms" -gt 0 ] || rms=1
+
+	printf "%8s %6s %12s %12s %12s %10s %10s\n" "$s" "$NJOBS" \
+		$((NJOBS * MB * 1000 / wms)) $((NJOBS * MB * 1000 / rms)) \
+		"$(cat "$SYS/compr_ratio")" "$(cat "$SYS/avg_comp_time")" \
+		"$(cat "$SYS/avg_decomp_time")"
+done
+
+echo 1 > "$SYS/reset"